@@ -0,0 +1,84 @@
+// Compression benchmark: ratio and CPU cost of the at-rest message codec on a synthetic corpus
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include "../src/message.h"
+
+// Function to generate a mail-like text body of roughly the given size
+std::string generateBody(std::mt19937 &rng, size_t size)
+{
+    static const std::vector<std::string> words = {
+        "the", "server", "message", "please", "find", "attached", "report", "meeting", "tomorrow",
+        "regards", "thanks", "update", "project", "deadline", "review", "and", "of", "to", "we",
+        "schedule", "lecture", "exercise", "submission", "protocol", "mailbox", "network", "socket"};
+    std::uniform_int_distribution<size_t> pick(0, words.size() - 1);
+    std::string body;
+    int lineLength = 0;
+    while (body.size() < size)
+    {
+        const std::string &word = words[pick(rng)];
+        body += word;
+        lineLength += word.size() + 1;
+        if (lineLength > 70)
+        {
+            body += "\n";
+            lineLength = 0;
+        }
+        else
+        {
+            body += " ";
+        }
+    }
+    return body + "\n";
+}
+
+int main()
+{
+    std::mt19937 rng(42);
+    const std::vector<size_t> sizes = {256, 4 * 1024, 64 * 1024, 1024 * 1024};
+    const int messagesPerSize = 50;
+
+    std::cout << std::left << std::setw(10) << "size" << std::setw(10) << "ratio"
+              << std::setw(16) << "compress MB/s" << "decompress MB/s\n";
+    for (size_t size : sizes)
+    {
+        std::vector<std::string> corpus;
+        size_t rawBytes = 0;
+        for (int i = 0; i < messagesPerSize; i++)
+        {
+            corpus.push_back(generateBody(rng, size));
+            rawBytes += corpus.back().size();
+        }
+
+        std::vector<std::string> compressed(corpus.size());
+        size_t compressedBytes = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < corpus.size(); i++)
+        {
+            compressBody(corpus[i], compressed[i]);
+            compressedBytes += compressed[i].size();
+        }
+        auto compressTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < corpus.size(); i++)
+        {
+            std::string body;
+            if (!decompressBody(compressed[i], corpus[i].size(), body) || body != corpus[i])
+            {
+                std::cerr << "round trip failed\n";
+                return EXIT_FAILURE;
+            }
+        }
+        auto decompressTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        double megabytes = rawBytes / (1024.0 * 1024.0);
+        std::cout << std::left << std::setw(10) << size << std::setw(10) << std::fixed << std::setprecision(2)
+                  << (double)rawBytes / compressedBytes << std::setw(16) << megabytes / compressTime
+                  << megabytes / decompressTime << "\n";
+    }
+    return EXIT_SUCCESS;
+}
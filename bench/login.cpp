@@ -0,0 +1,239 @@
+// Login benchmark: serves a stub LDAP directory and times LOGINs of a server pointed at it
+// (TWMAILER_LDAP_URI=ldap://127.0.0.1:<ldap-port>). The first round of logins has to ask the directory,
+// the following rounds show what the credential cache saves; every bind the directory answers is counted.
+// The stub knows the simple bind and search requests the server sends, every user's password is "secret".
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include "../src/mailclient.h"
+
+#define STUB_PASSWORD "secret"
+
+static std::atomic<int> bindCount(0);
+static int ldapDelayMs = 0;
+
+// Function to read exactly size bytes
+static bool readExact(int socket, std::string &data, size_t size)
+{
+    data.resize(size);
+    size_t received = 0;
+    while (received < size)
+    {
+        ssize_t n = recv(socket, &data[received], size - received, 0);
+        if (n <= 0)
+            return false;
+        received += n;
+    }
+    return true;
+}
+
+// Function to read one BER element from the socket, returns its tag and content
+static bool readElement(int socket, unsigned char &tag, std::string &content)
+{
+    std::string header;
+    if (!readExact(socket, header, 2))
+        return false;
+    tag = header[0];
+    size_t length = (unsigned char)header[1];
+    if (length & 0x80)
+    {
+        std::string lengthBytes;
+        if ((length & 0x7f) > 4 || !readExact(socket, lengthBytes, length & 0x7f))
+            return false;
+        length = 0;
+        for (unsigned char byte : lengthBytes)
+            length = (length << 8) | byte;
+    }
+    return readExact(socket, content, length);
+}
+
+// Function to split the next BER element off the front of data
+static bool nextElement(std::string &data, unsigned char &tag, std::string &content)
+{
+    if (data.size() < 2)
+        return false;
+    tag = data[0];
+    size_t length = (unsigned char)data[1], headerSize = 2;
+    if (length & 0x80)
+    {
+        size_t lengthBytes = length & 0x7f;
+        if (lengthBytes > 4 || data.size() < 2 + lengthBytes)
+            return false;
+        length = 0;
+        for (size_t i = 0; i < lengthBytes; i++)
+            length = (length << 8) | (unsigned char)data[2 + i];
+        headerSize += lengthBytes;
+    }
+    if (data.size() < headerSize + length)
+        return false;
+    content = data.substr(headerSize, length);
+    data.erase(0, headerSize + length);
+    return true;
+}
+
+// Function to encode a BER element
+static std::string element(unsigned char tag, const std::string &content)
+{
+    std::string encoded(1, (char)tag);
+    if (content.size() < 0x80)
+    {
+        encoded += (char)content.size();
+    }
+    else
+    {
+        encoded += (char)0x84;
+        for (int shift = 24; shift >= 0; shift -= 8)
+            encoded += (char)((content.size() >> shift) & 0xff);
+    }
+    return encoded + content;
+}
+
+// Function to encode an LDAPResult (BindResponse, SearchResultDone) with the given result code
+static std::string ldapResult(unsigned char tag, int resultCode)
+{
+    return element(tag, element(0x0a, std::string(1, (char)resultCode)) + element(0x04, "") + element(0x04, ""));
+}
+
+// Function to answer the requests of one LDAP connection: bind, search for the bound uid, unbind
+static void serveLdapConnection(int socket)
+{
+    std::string uid;
+    unsigned char tag;
+    std::string message;
+    while (readElement(socket, tag, message) && tag == 0x30)
+    {
+        // LDAPMessage: messageID, protocolOp (controls are ignored)
+        std::string messageId, op;
+        unsigned char idTag, opTag;
+        if (!nextElement(message, idTag, messageId) || !nextElement(message, opTag, op))
+            break;
+        std::string reply;
+        if (opTag == 0x60)
+        {
+            // BindRequest: version, name "uid=<uid>,...", simple password [0]
+            std::string version, name, password;
+            unsigned char versionTag, nameTag, passwordTag;
+            if (!nextElement(op, versionTag, version) || !nextElement(op, nameTag, name) || !nextElement(op, passwordTag, password))
+                break;
+            uid = name.substr(name.find('=') + 1, name.find(',') - name.find('=') - 1);
+            bindCount++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(ldapDelayMs));
+            reply = ldapResult(0x61, password == STUB_PASSWORD ? 0 : 49);
+        }
+        else if (opTag == 0x63)
+        {
+            // SearchRequest: one SearchResultEntry with the uid attribute, then SearchResultDone
+            std::string attribute = element(0x30, element(0x04, "uid") + element(0x31, element(0x04, uid)));
+            std::string entry = element(0x64, element(0x04, "uid=" + uid + ",ou=people,dc=technikum-wien,dc=at") +
+                                                  element(0x30, attribute));
+            reply = element(0x30, element(0x02, messageId) + entry);
+            reply += element(0x30, element(0x02, messageId) + ldapResult(0x65, 0));
+            if (send(socket, reply.data(), reply.size(), MSG_NOSIGNAL) < 0)
+                break;
+            continue;
+        }
+        else
+        {
+            // UnbindRequest or anything the stub does not know
+            break;
+        }
+        reply = element(0x30, element(0x02, messageId) + reply);
+        if (send(socket, reply.data(), reply.size(), MSG_NOSIGNAL) < 0)
+            break;
+    }
+    close(socket);
+}
+
+// Function to run the stub directory on 127.0.0.1:port
+static bool startLdapStub(int port)
+{
+    int listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int reuse = 1;
+    if (listenSocket < 0 || setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+        bind(listenSocket, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenSocket, SOMAXCONN) < 0)
+    {
+        return false;
+    }
+    std::thread([listenSocket]()
+                {
+        while (true)
+        {
+            int client = accept(listenSocket, NULL, NULL);
+            if (client >= 0)
+                std::thread(serveLdapConnection, client).detach();
+        } })
+        .detach();
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 6)
+    {
+        std::cout << "Usage: " << argv[0] << " <ip> <port> <ldap-port> <users> <rounds> [ldap-delay-ms]\n"
+                  << "Serves a stub directory on 127.0.0.1:<ldap-port>, start the server with\n"
+                  << "TWMAILER_LDAP_URI=ldap://127.0.0.1:<ldap-port>. Every round logs each user in once.\n";
+        return EXIT_FAILURE;
+    }
+    const char *serverIp = argv[1];
+    int serverPort = std::stoi(argv[2]);
+    int ldapPort = std::stoi(argv[3]);
+    int users = std::stoi(argv[4]);
+    int rounds = std::stoi(argv[5]);
+    ldapDelayMs = argc > 6 ? std::stoi(argv[6]) : 0;
+
+    if (!startLdapStub(ldapPort))
+    {
+        perror("Error starting the LDAP stub");
+        return EXIT_FAILURE;
+    }
+
+    int failures = 0;
+    for (int round = 1; round <= rounds; round++)
+    {
+        int bindsBefore = bindCount;
+        std::vector<double> latencies; // ms from sending LOGIN until its reply arrived
+        for (int user = 0; user < users; user++)
+        {
+            MailConnection connection;
+            std::string welcome, reply;
+            std::string request = buildRequest("LOGIN", {"bench" + std::to_string(user), STUB_PASSWORD});
+            if (!connectToServer(connection, serverIp, serverPort, welcome))
+            {
+                failures++;
+                continue;
+            }
+            auto start = std::chrono::steady_clock::now();
+            if (!sendRequest(connection, request) || !receiveReply(connection, request, reply) || reply.rfind("OK\n", 0) != 0)
+            {
+                failures++;
+            }
+            else
+            {
+                latencies.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            }
+            sendRequest(connection, "QUIT\n");
+            closeConnection(connection);
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&](double p)
+        { return latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, (size_t)(p * latencies.size()))]; };
+        std::cout << "round " << round << ": " << latencies.size() << " logins, " << bindCount - bindsBefore
+                  << " LDAP binds, p50 " << percentile(0.50) << " ms, p99 " << percentile(0.99) << " ms\n";
+    }
+    std::cout << "failed: " << failures << "\n";
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,246 @@
+// Microbenchmarks of the server's hot paths: request framing/parsing, message id allocation (the first one on
+// a mailbox and the following ones), LIST on synthetic mailboxes and contended rate-limiter checks.
+// Results are printed as JSON.
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <unistd.h>
+#include "../src/protocol.h"
+#include "../src/mailbox.h"
+#include "../src/ratelimit.h"
+
+namespace fs = std::filesystem;
+
+struct Result
+{
+    std::string name;
+    long long iterations;
+    double nsPerOp;
+};
+
+static std::vector<Result> results;
+
+// Function to run op repeatedly for at least minTime (and minIterations) and record the time per call
+static void measure(const std::string &name, std::function<void()> op, long long minIterations = 1,
+                    std::chrono::milliseconds minTime = std::chrono::milliseconds(200))
+{
+    op(); // warm up caches
+    long long iterations = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::steady_clock::duration::zero();
+    while (iterations < minIterations || elapsed < minTime)
+    {
+        op();
+        iterations++;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+    results.push_back({name, iterations, ns});
+    std::cerr << name << ": " << ns << " ns/op\n";
+}
+
+// Function to time the first id allocation on a mailbox, i.e. the scan for the highest id that
+// writes <userDir>/.next; the counter file is removed before every (timed) call
+static void measureFirstAllocation(const std::string &name, const fs::path &userDir, long long minIterations = 5,
+                                   std::chrono::milliseconds minTime = std::chrono::milliseconds(200))
+{
+    long long iterations = 0;
+    auto elapsed = std::chrono::steady_clock::duration::zero();
+    while (iterations < minIterations || elapsed < minTime)
+    {
+        fs::remove(userDir / ".next");
+        auto start = std::chrono::steady_clock::now();
+        allocateMessageIds(userDir);
+        elapsed += std::chrono::steady_clock::now() - start;
+        iterations++;
+    }
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+    results.push_back({name, iterations, ns});
+    std::cerr << name << ": " << ns << " ns/op\n";
+}
+
+// Function to create a mailbox with count messages
+static void createMailbox(const fs::path &userDir, int count)
+{
+    fs::create_directories(userDir);
+    for (int id = 1; id <= count; id++)
+    {
+        std::ofstream outFile(userDir / (std::to_string(id) + ".msg"));
+        outFile << "Sender: user" << id % 7 << "\nSubject: synthetic message " << id
+                << "\nMessage:\nline one of the body\nline two of the body\n.\n";
+    }
+}
+
+static void benchParser()
+{
+    const std::vector<std::pair<std::string, std::string>> requests = {
+        {"login", "LOGIN\nif23b001\nsecret password\n"},
+        {"list", "LIST 0 20\n"},
+        {"read", "READ 42\n"},
+        {"mread", "MREAD\n1,3,7-12,100-200\n"},
+        {"send_1k", "SEND\nif23b002\nweekly report\n" + std::string(1000, 'x') + "\n.\n"},
+    };
+    for (const auto &request : requests)
+    {
+        const std::string &text = request.second;
+        measure("parse/" + request.first, [&]()
+                {
+            size_t end = findRequestEnd(text);
+            Request parsed = parseRequest(text.substr(0, end));
+            if (parsed.command.empty())
+                abort(); });
+    }
+
+    // an unfinished 1 MB SEND arriving in 1 KB receives, each one is framed where the last stopped
+    std::string bigSend = "SEND\nif23b002\nlarge\n";
+    while (bigSend.size() < 1024 * 1024)
+        bigSend += "short line\n";
+    bigSend += ".\n";
+    measure("parse/send_1m_chunked", [&]()
+            {
+        std::string received;
+        FramingState state;
+        size_t end = 0;
+        for (size_t pos = 0; end == 0 && pos < bigSend.size(); pos += 1024)
+        {
+            received.append(bigSend, pos, 1024);
+            end = findRequestEnd(received, state);
+        }
+        if (end != bigSend.size())
+            abort(); });
+
+    // 32 pipelined requests in one receive buffer
+    std::string pipelined;
+    for (int i = 0; i < 8; i++)
+    {
+        for (const auto &request : requests)
+        {
+            if (request.first != "send_1k")
+                pipelined += request.second;
+        }
+    }
+    measure("parse/pipelined_32", [&]()
+            {
+        size_t pos = 0, end;
+        while ((end = findRequestEnd(pipelined, pos)) != 0)
+        {
+            parseRequest(pipelined.substr(pos, end - pos));
+            pos = end;
+        } });
+}
+
+static void benchMailbox(const fs::path &root, int size)
+{
+    fs::path userDir = root / std::to_string(size) / "user";
+    std::cerr << "creating mailbox with " << size << " messages\n";
+    createMailbox(userDir, size);
+    std::string suffix = "/" + std::to_string(size);
+
+    // the first allocation scans the mailbox, every further one only updates the high-water mark
+    // and does not depend on the mailbox size (see benchNextId)
+    measureFirstAllocation("allocate_id_first" + suffix, userDir);
+    measure("list_all" + suffix, [&]()
+            {
+        std::string lines;
+        int count;
+        listMessages(userDir, "", "", lines, count); });
+    measure("list_since" + suffix, [&]()
+            {
+        std::string lines;
+        int count;
+        listMessages(userDir, std::to_string(std::max(0, size - 10)), "", lines, count); });
+    measure("list_page" + suffix, [&]()
+            {
+        std::string lines;
+        int count;
+        listMessages(userDir, "0", "20", lines, count); });
+}
+
+// Function to time the id allocations after the first one, which read and write <userDir>/.next
+static void benchNextId(const fs::path &root)
+{
+    fs::path userDir = root / "next" / "user";
+    createMailbox(userDir, 1);
+    measure("allocate_id", [&]()
+            { allocateMessageIds(userDir); });
+}
+
+static void benchRateLimiter()
+{
+    const int keys = 1024;
+    // every 8th key is blacklisted, the others have no or too few failures
+    for (int i = 0; i < keys; i += 8)
+    {
+        for (int fail = 0; fail < 3; fail++)
+            registerLoginFailure("10.0.0." + std::to_string(i) + "_user");
+    }
+    for (int i = 1; i < keys; i += 8)
+    {
+        registerLoginFailure("10.0.0." + std::to_string(i) + "_user");
+    }
+
+    for (int threads : {1, 2, 4, 8})
+    {
+        const long long opsPerThread = 200000;
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        std::atomic<long long> blacklisted(0);
+        for (int t = 0; t < threads; t++)
+        {
+            workers.emplace_back([&, t]()
+                                 {
+                long long hits = 0;
+                for (long long i = 0; i < opsPerThread; i++)
+                {
+                    hits += isBlacklisted("10.0.0." + std::to_string((i * 7 + t) % keys) + "_user");
+                }
+                blacklisted += hits; });
+        }
+        for (auto &worker : workers)
+            worker.join();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        // wall time per check across all threads, i.e. the inverse of the aggregate throughput
+        results.push_back({"ratelimit/threads_" + std::to_string(threads), opsPerThread * threads, ns / (opsPerThread * threads)});
+        std::cerr << "ratelimit/threads_" << threads << ": " << results.back().nsPerOp << " ns/op\n";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    // mailbox sizes can be given as arguments, e.g. "10 1000" for a quick run
+    std::vector<int> sizes = {10, 1000, 100000};
+    if (argc > 1)
+    {
+        sizes.clear();
+        for (int i = 1; i < argc; i++)
+            sizes.push_back(std::stoi(argv[i]));
+    }
+
+    fs::path root = fs::temp_directory_path() / ("twmailer-bench-" + std::to_string(getpid()));
+    benchParser();
+    benchNextId(root);
+    for (int size : sizes)
+    {
+        benchMailbox(root, size);
+    }
+    fs::remove_all(root);
+    benchRateLimiter();
+
+    std::cout << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        std::cout << "    {\"name\": \"" << results[i].name << "\", \"iterations\": " << results[i].iterations
+                  << ", \"ns_per_op\": " << std::fixed << results[i].nsPerOp
+                  << ", \"ops_per_sec\": " << 1e9 / results[i].nsPerOp << "}"
+                  << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    std::cout << "  ]\n}\n";
+    return EXIT_SUCCESS;
+}
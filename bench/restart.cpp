@@ -0,0 +1,219 @@
+// Restart load harness: logged-in sessions keep pipelining requests while the server is restarted.
+// Reports requests that got an error or no reply at all (requests a draining server ended with BYE
+// are not handled and are sent again on a new session), sessions the server closed, failed logins,
+// the connect latency of new sessions and how long the handoff took: until the new server took over
+// the listening socket and until the old one had drained and exited.
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <csignal>
+#include <unistd.h>
+#include "../src/protocol.h"
+#include "../src/mailclient.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Function to start the new server with its stdout on a pipe, returns the read end (-1 on error)
+static int spawnServer(char **command, pid_t &pid)
+{
+    int output[2];
+    if (pipe(output) < 0)
+        return -1;
+    pid = fork();
+    if (pid < 0)
+        return -1;
+    if (pid == 0)
+    {
+        dup2(output[1], STDOUT_FILENO);
+        // the sessions of the workers must not stay open in the new server
+        for (int fd = STDERR_FILENO + 1; fd < sysconf(_SC_OPEN_MAX); fd++)
+            close(fd);
+        execvp(command[0], command);
+        perror("exec");
+        _exit(127);
+    }
+    close(output[1]);
+    return output[0];
+}
+
+// Function to check if the old server still runs (an exited one may stay a zombie until its parent reaps it)
+static bool isRunning(pid_t pid)
+{
+    if (kill(pid, 0) != 0)
+        return false;
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string pidField, name, state;
+    return !(stat >> pidField >> name >> state) || state != "Z";
+}
+
+// Function to check if a request got a proper reply (ERR or a broken LIST count line are not)
+static bool isGoodReply(const std::string &request, const std::string &reply)
+{
+    if (reply.rfind("ERR", 0) == 0)
+        return false;
+    if (getCommand(request) == "LIST")
+        return reply.find(": ") != std::string::npos;
+    return reply.rfind("OK\n", 0) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 6 && argc < 8)
+    {
+        std::cout << "Usage: " << argv[0] << " <ip> <port> <seconds> <user> <password> [<old-pid> <new-server-command...>]\n"
+                  << "After half of the time the new server is started (e.g. ./server 6543 mail-spool with the\n"
+                  << "same TWMAILER_HANDOFF_SOCKET as the running one <old-pid>), its output is shown until it exits.\n";
+        return EXIT_FAILURE;
+    }
+    const char *serverIp = argv[1];
+    int serverPort = std::stoi(argv[2]);
+    auto duration = std::chrono::seconds(std::stoi(argv[3]));
+    std::string user = argv[4], password = argv[5];
+    const int workers = 8;
+    signal(SIGPIPE, SIG_IGN);
+
+    std::mutex resultMutex;
+    std::vector<double> latencies; // ms from connect() until the LOGIN reply arrived
+    std::atomic<long> answered(0), badReplies(0), unanswered(0), resent(0), closedSessions(0), failedLogins(0);
+    std::atomic<bool> stop(false);
+
+    // every batch mixes the requests a mail client polls with, its replies are checked one by one
+    std::vector<std::string> batch;
+    for (int i = 0; i < PIPELINE_DEPTH; i++)
+        batch.push_back(i % 2 == 0 ? "STAT\n" : buildListRequest("0 5"));
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < workers; i++)
+    {
+        threads.emplace_back([&]()
+                             {
+            std::vector<double> local;
+            std::vector<std::string> requests = batch;
+            while (!stop)
+            {
+                auto start = Clock::now();
+                MailConnection connection;
+                std::string welcome, reply;
+                std::string login = buildRequest("LOGIN", {user, password});
+                if (!connectToServer(connection, serverIp, serverPort, welcome) || !sendRequest(connection, login) ||
+                    !receiveReply(connection, login, reply) || reply.rfind("OK\n", 0) != 0)
+                {
+                    // BYE: accepted just before the drain, the LOGIN was not handled
+                    if (connection.closedByServer)
+                        closedSessions++;
+                    else
+                        failedLogins++;
+                    closeConnection(connection);
+                    continue;
+                }
+                local.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+
+                // the session stays open across the restart until the server closes it
+                while (!stop)
+                {
+                    std::vector<std::string> replies;
+                    bool ok = sendPipelined(connection, requests, replies);
+                    for (size_t r = 0; r < replies.size(); r++)
+                    {
+                        if (isGoodReply(requests[r], replies[r]))
+                            answered++;
+                        else
+                            badReplies++;
+                    }
+                    if (!ok)
+                    {
+                        // after BYE the rest was not handled and goes out again on the next session
+                        std::vector<std::string> rest(requests.begin() + replies.size(), requests.end());
+                        if (connection.closedByServer)
+                        {
+                            resent += rest.size();
+                            requests = rest;
+                        }
+                        else
+                        {
+                            unanswered += rest.size();
+                            requests = batch;
+                        }
+                        closedSessions++;
+                        break;
+                    }
+                    requests = batch;
+                }
+                if (stop)
+                    sendRequest(connection, "QUIT\n");
+                closeConnection(connection);
+            }
+            resultMutex.lock();
+            latencies.insert(latencies.end(), local.begin(), local.end());
+            resultMutex.unlock(); });
+    }
+
+    std::this_thread::sleep_for(duration / 2);
+    std::atomic<double> takeoverMs(-1);
+    double drainMs = -1;
+    pid_t newPid = -1;
+    if (argc > 6)
+    {
+        pid_t oldPid = std::stoi(argv[6]);
+        auto restart = Clock::now();
+        int output = spawnServer(argv + 7, newPid);
+        if (output < 0)
+        {
+            perror("Starting the new server failed");
+            return EXIT_FAILURE;
+        }
+        // the new server reports the takeover, everything it prints is passed on
+        std::thread([output, restart, &takeoverMs]()
+                    {
+            FILE *lines = fdopen(output, "r");
+            char line[512];
+            while (fgets(line, sizeof(line), lines) != NULL)
+            {
+                if (takeoverMs < 0 && std::string(line).find("Took over the listening socket") != std::string::npos)
+                    takeoverMs = std::chrono::duration<double, std::milli>(Clock::now() - restart).count();
+                std::cout << "[new server] " << line << std::flush;
+            }
+            fclose(lines); })
+            .detach();
+        while (isRunning(oldPid) && Clock::now() - restart < duration)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (!isRunning(oldPid))
+            drainMs = std::chrono::duration<double, std::milli>(Clock::now() - restart).count();
+    }
+    std::this_thread::sleep_for(duration / 2);
+    stop = true;
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p)
+    { return latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, (size_t)(p * latencies.size()))]; };
+    std::cout << "requests answered:   " << answered << "\n"
+              << "error replies:       " << badReplies << "\n"
+              << "unanswered requests: " << unanswered << "\n"
+              << "resent after BYE:    " << resent << "\n"
+              << "sessions closed:     " << closedSessions << "\n"
+              << "failed logins:       " << failedLogins << "\n"
+              << "login p50:           " << percentile(0.50) << " ms\n"
+              << "login p99:           " << percentile(0.99) << " ms\n"
+              << "login max:           " << (latencies.empty() ? 0.0 : latencies.back()) << " ms\n";
+    if (newPid > 0)
+    {
+        std::cout << "new server pid:      " << newPid << " (keeps running)\n"
+                  << "takeover after:      " << takeoverMs.load() << " ms\n"
+                  << "old server exited:   " << drainMs << " ms (-1: still running)\n";
+    }
+    return badReplies == 0 && unanswered == 0 && failedLogins == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,61 @@
+// Stand-in for libFuzzer when clang is not available: replays the given corpus files and then
+// feeds randomly spliced protocol fragments to the harness for -max_total_time seconds.
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int main(int argc, char **argv)
+{
+    int seconds = 10;
+    std::vector<std::string> corpus;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "-max_total_time=", 16) == 0)
+        {
+            seconds = atoi(argv[i] + 16);
+            continue;
+        }
+        std::ifstream inFile(argv[i], std::ios::binary);
+        corpus.emplace_back(std::istreambuf_iterator<char>(inFile), std::istreambuf_iterator<char>());
+        LLVMFuzzerTestOneInput((const uint8_t *)corpus.back().data(), corpus.back().size());
+    }
+    std::cout << "replayed " << corpus.size() << " corpus file(s)\n";
+
+    const std::vector<std::string> fragments = {
+        "LOGIN", "SEND", "LIST", "READ", "DEL", "MREAD", "MDEL", "STAT", "RESUME", "CAPA", "QUIT",
+        "\n", "\n", " ", ".", "\n.\n", "-", ",", "0", "999999999", "4294967296", "-1", "1-3", "\r\n", std::string(1, '\0')};
+    std::mt19937 rng(12345);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    long long runs = 0;
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        std::string input = corpus.empty() ? "" : corpus[rng() % corpus.size()];
+        for (int edits = rng() % 8 + 1; edits > 0; edits--)
+        {
+            size_t at = input.empty() ? 0 : rng() % (input.size() + 1);
+            switch (rng() % 3)
+            {
+            case 0:
+                input.insert(at, fragments[rng() % fragments.size()]);
+                break;
+            case 1:
+                if (!input.empty())
+                    input.erase(at, rng() % 8);
+                break;
+            default:
+                input.insert(at, 1, (char)(rng() % 256));
+            }
+        }
+        LLVMFuzzerTestOneInput((const uint8_t *)input.data(), input.size());
+        runs++;
+    }
+    std::cout << "ran " << runs << " random inputs without a crash\n";
+    return 0;
+}
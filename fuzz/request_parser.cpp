@@ -0,0 +1,45 @@
+// libFuzzer harness for the request parser: arbitrary bytes as they could arrive on a connection
+// are framed like clientCommunication does and every field goes through the parameter parsers.
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include "../src/protocol.h"
+#include "../src/mailbox.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    std::string buffer((const char *)data, size);
+    size_t pos = 0;
+    while (pos < buffer.size())
+    {
+        size_t end = findRequestEnd(buffer, pos);
+        if (end == 0)
+            break;
+        if (end <= pos || end > buffer.size())
+            abort(); // the framer must always make progress inside the buffer
+
+        // framing the request as it trickles in must end at the same place
+        std::string received;
+        FramingState state;
+        size_t incrementalEnd = 0;
+        for (size_t next = pos; incrementalEnd == 0 && next < buffer.size(); next += 7)
+        {
+            received = buffer.substr(pos, std::min<size_t>(next + 7, buffer.size()) - pos);
+            incrementalEnd = findRequestEnd(received, state);
+        }
+        if (incrementalEnd != end - pos)
+            abort();
+
+        Request request = parseRequest(buffer.substr(pos, end - pos));
+        getParameterCount(request.command);
+        getTokenUser(request.param1);
+        isNumber(request.param1);
+        isNumber(request.param2);
+        std::vector<std::pair<int, int>> ranges;
+        parseIdRanges(request.param1, ranges);
+        pos = end;
+    }
+    return 0;
+}
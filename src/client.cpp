@@ -1,71 +1,41 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <string>
+#include <vector>
 #include <cstring>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
 #include <unistd.h>
 #include <limits>
 #include <termios.h>
-
-#define BUF 1024
-
-// Function to validate the username
-bool validateUsername(const std::string &username)
-{
-    if (username.length() > 8)
-        return false;
-    for (char c : username)
-    {
-        if (!isalnum(c))
-        {
-            return false;
-        }
-    }
-    return true;
-}
-
-// Function to validate the subject
-bool validateSubject(const std::string &subject)
-{
-    return subject.length() <= 80;
-}
+#include "mailclient.h"
+#include "protocol.h"
 
 // Function to show the usage of the program
 void showUsage(const char *programName)
 {
-    std::cout << "Usage: " << programName << " <ip> <port>\n"
-              << "IP and port define the address of the server application.\n";
+    std::cout << "Usage: " << programName << " <ip> <port> [batch-file | -]\n"
+              << "IP and port define the address of the server application.\n"
+              << "With a batch file (or - for stdin) the raw requests in it are pipelined to the server\n"
+              << "and every reply is printed, e.g. \"LOGIN\\n<user>\\n<password>\\nLIST\\nREAD 1\\n\".\n";
 }
 
-// Function to send a request to the server
-void sendRequest(int client_socket, const std::string &request)
+// Function to send a request and wait for its complete reply
+std::string exchange(MailConnection &connection, const std::string &request)
 {
-    if (send(client_socket, request.c_str(), request.size(), 0) == -1)
+    if (!sendRequest(connection, request))
     {
         perror("Send error");
         exit(EXIT_FAILURE);
     }
-}
 
-// Function to receive a response from the server
-std::string receiveResponse(int client_socket)
-{
-    std::string buffer(BUF, '\0');
-    int size = recv(client_socket, &buffer[0], buffer.size(), 0);
-    if (size == -1)
-    {
-        perror("Receive error");
-        exit(EXIT_FAILURE);
-    }
-    else if (size == 0)
+    std::string reply;
+    if (!receiveReply(connection, request, reply))
     {
-        std::cerr << "Server closed the connection.\n";
+        std::cerr << (connection.closedByServer ? "Server is restarting, the request was not handled. Please reconnect.\n"
+                                                : "Server closed the connection.\n");
         exit(EXIT_FAILURE);
     }
-    buffer.resize(size);
-    return buffer;
+    return reply;
 }
 
 // Function to get password with hidden input
@@ -93,19 +63,19 @@ int getch()
 }
 
 // Function to get password with hidden input
-const char *getpass()
+std::string getpass()
 {
     int show_asterisk = 0;
 
     const char BACKSPACE = 127;
     const char RETURN = 10;
 
-    unsigned char ch = 0;
+    int ch = 0;
     std::string password;
 
     printf("Password: ");
 
-    while ((ch = getch()) != RETURN)
+    while ((ch = getch()) != RETURN && ch != EOF)
     {
         if (ch == BACKSPACE)
         {
@@ -129,12 +99,11 @@ const char *getpass()
     }
     printf("\n");
 
-    const char *passwordCStr = password.c_str();
-    return passwordCStr;
+    return password;
 }
 
 // Function to login with LDAP
-void handleLogin(int client_socket)
+void handleLogin(MailConnection &connection)
 {
     std::string ldap_username, password;
     std::cout << "LDAP username: ";
@@ -142,13 +111,8 @@ void handleLogin(int client_socket)
 
     std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
     password = getpass();
-    // std::cout << "Password: ";
-    // std::cin >> password;
-
-    std::string request = "LOGIN\n" + ldap_username + "\n" + password + "\n";
-    sendRequest(client_socket, request);
 
-    std::string response = receiveResponse(client_socket);
+    std::string response = exchange(connection, buildRequest("LOGIN", {ldap_username, password}));
 
     if (response == "ERR\n")
     {
@@ -159,12 +123,30 @@ void handleLogin(int client_socket)
         std::cout << "Server: \n"
                   << response << std::endl;
     }
+}
 
-    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+// Function to resume a session with the token returned by a previous LOGIN
+void handleResume(MailConnection &connection)
+{
+    std::string token;
+    std::cout << "Session token: ";
+    std::cin >> token;
+    std::cin.ignore();
+
+    std::string response = exchange(connection, buildRequest("RESUME", {token}));
+    if (response == "ERR\n")
+    {
+        std::cout << "Resume failed." << std::endl;
+    }
+    else
+    {
+        std::cout << "Server: \n"
+                  << response << std::endl;
+    }
 }
 
 // Function to handle the SEND command
-void handleSend(int client_socket)
+void handleSend(MailConnection &connection)
 {
     std::string receiver, subject, message, line;
 
@@ -201,22 +183,16 @@ void handleSend(int client_socket)
         message += line + "\n";
     }
 
-    std::string request = "SEND\n" + receiver + "\n" + subject + "\n" + message + ".\n";
-    sendRequest(client_socket, request);
-
-    std::string response = receiveResponse(client_socket);
+    std::string response = exchange(connection, buildSendRequest(receiver, subject, message));
     std::cout << "Server: \n"
               << response << std::endl;
 }
 
 // Function to handle the LIST command
-void handleList(int client_socket)
+// args is empty, "<since-id>" or "<offset> <limit>"
+void handleList(MailConnection &connection, const std::string &args)
 {
-
-    std::string request = "LIST\n";
-    sendRequest(client_socket, request);
-
-    std::string response = receiveResponse(client_socket);
+    std::string response = exchange(connection, buildListRequest(args));
 
     if (response == "ERR\n")
     {
@@ -227,12 +203,18 @@ void handleList(int client_socket)
         std::cout << "Server: \n"
                   << response << std::endl;
     }
+}
 
-    // std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+// Function to handle the STAT command
+void handleStat(MailConnection &connection)
+{
+    std::string response = exchange(connection, "STAT\n");
+    std::cout << "Server: \n"
+              << response << std::endl;
 }
 
 // Function to handle the READ command
-void handleRead(int client_socket)
+void handleRead(MailConnection &connection)
 {
     std::string message_number;
 
@@ -240,123 +222,180 @@ void handleRead(int client_socket)
     std::cin >> message_number;
     std::cin.ignore();
 
-    std::string request = "READ\n" + message_number + "\n";
-    sendRequest(client_socket, request);
-
-    std::string response = receiveResponse(client_socket);
+    std::string response = exchange(connection, buildRequest("READ", {message_number}));
     std::cout << "\n"
               << "Server: \n"
               << response << std::endl;
 }
 
 // Function to handle the DEL command
-void handleDel(int client_socket)
+void handleDel(MailConnection &connection)
 {
     std::string message_number;
 
     std::cout << "Message number: ";
     std::cin >> message_number;
     std::cin.ignore();
-    std::string request = "DEL\n" + message_number + "\n";
-    sendRequest(client_socket, request);
 
-    std::string response = receiveResponse(client_socket);
+    std::string response = exchange(connection, buildRequest("DEL", {message_number}));
+    std::cout << "Server: \n"
+              << response << std::endl;
+}
+
+// Function to handle the MREAD and MDEL commands, ids are given like 1,3,7-12
+void handleMulti(MailConnection &connection, const std::string &command)
+{
+    std::string ids;
+
+    std::cout << "Message ids: ";
+    std::cin >> ids;
+    std::cin.ignore();
+
+    std::string response = exchange(connection, buildRequest(command, {ids}));
     std::cout << "Server: \n"
               << response << std::endl;
 }
 
 // Function to handle the QUIT command
-void handleQuit(int client_socket)
+void handleQuit(MailConnection &connection)
 {
-    sendRequest(client_socket, "QUIT\n");
+    sendRequest(connection, "QUIT\n");
 }
 
-// Main function where the client connects to the server and waits for user input
-int main(int argc, char **argv)
+// Function to pipeline all requests of a batch file (or stdin) and print the replies
+int runBatch(MailConnection &connection, const std::string &batchFile)
 {
-    if (argc != 3)
+    std::ifstream inFile;
+    if (batchFile != "-")
     {
-        showUsage(argv[0]);
-        return EXIT_FAILURE;
+        inFile.open(batchFile);
+        if (!inFile)
+        {
+            std::cerr << "Cannot open batch file " << batchFile << "\n";
+            return EXIT_FAILURE;
+        }
     }
+    std::istream &input = batchFile == "-" ? std::cin : inFile;
+    std::string content((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
 
-    const char *serverIp = argv[1];
-    int serverPort = std::stoi(argv[2]);
-
-    int client_socket;
-    sockaddr_in server_address;
+    std::vector<std::string> requests, replies;
+    if (!splitRequests(content, requests))
+    {
+        std::cerr << "Batch input ends with an unfinished request.\n";
+        return EXIT_FAILURE;
+    }
+    if (requests.empty() || getCommand(requests.back()) != "QUIT")
+    {
+        requests.push_back("QUIT\n");
+    }
 
-    if ((client_socket = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+    bool ok = sendPipelined(connection, requests, replies);
+    for (const auto &reply : replies)
+    {
+        std::cout << reply;
+    }
+    if (!ok)
     {
-        perror("Socket creation error");
+        std::cerr << (connection.closedByServer ? "Server is restarting, the requests without a reply were not handled.\n"
+                                                : "Server closed the connection.\n");
         return EXIT_FAILURE;
     }
+    return EXIT_SUCCESS;
+}
 
-    server_address.sin_family = AF_INET;
-    server_address.sin_port = htons(serverPort);
-    if (!inet_aton(serverIp, &server_address.sin_addr))
+// Main function where the client connects to the server and waits for user input
+int main(int argc, char **argv)
+{
+    if (argc != 3 && argc != 4)
     {
-        std::cerr << "Invalid IP address format.\n";
+        showUsage(argv[0]);
         return EXIT_FAILURE;
     }
 
-    if (connect(client_socket, (sockaddr *)&server_address, sizeof(server_address)) == -1)
+    const char *serverIp = argv[1];
+    int serverPort = std::stoi(argv[2]);
+
+    MailConnection connection;
+    std::string welcome;
+    if (!connectToServer(connection, serverIp, serverPort, welcome))
     {
         perror("Connection error");
         return EXIT_FAILURE;
     }
 
-    std::cout << "Connection with server established!\n";
-
-    std::string mainBuffer(BUF, '\0');
-    int size = recv(client_socket, &mainBuffer[0], mainBuffer.size(), 0);
-    if (size > 0)
+    if (argc == 4)
     {
-        mainBuffer.resize(size);
-        std::cout << mainBuffer;
+        int result = runBatch(connection, argv[3]);
+        closeConnection(connection);
+        return result;
     }
 
+    std::cout << "Connection with server established!\n";
+    std::cout << welcome;
+
     // Main loop to handle user input
     while (true)
     {
         std::cout << ">> ";
         std::string command;
-        std::getline(std::cin, command);
+        if (!std::getline(std::cin, command))
+            break;
 
         if (command.empty())
             continue;
 
+        // Split off optional arguments (e.g. "LIST 0 20")
+        std::string args;
+        size_t space = command.find(' ');
+        if (space != std::string::npos)
+        {
+            args = command.substr(space + 1);
+            command.resize(space);
+        }
+
         if (command == "LOGIN")
         {
-            handleLogin(client_socket);
+            handleLogin(connection);
+        }
+        else if (command == "RESUME")
+        {
+            handleResume(connection);
         }
         else if (command == "SEND")
         {
-            handleSend(client_socket);
+            handleSend(connection);
         }
         else if (command == "LIST")
         {
-            handleList(client_socket);
+            handleList(connection, args);
+        }
+        else if (command == "STAT")
+        {
+            handleStat(connection);
         }
         else if (command == "READ")
         {
-            handleRead(client_socket);
+            handleRead(connection);
         }
         else if (command == "DEL")
         {
-            handleDel(client_socket);
+            handleDel(connection);
+        }
+        else if (command == "MREAD" || command == "MDEL")
+        {
+            handleMulti(connection, command);
         }
         else if (command == "QUIT")
         {
-            handleQuit(client_socket);
+            handleQuit(connection);
             break;
         }
         else
         {
-            std::cout << "Unknown command. Try LOGIN, SEND, LIST, READ, DEL, or QUIT.\n";
+            std::cout << "Unknown command. Try LOGIN, RESUME, SEND, LIST [since-id | offset limit], STAT, READ, DEL, MREAD, MDEL, or QUIT.\n";
         }
     }
 
-    close(client_socket);
+    closeConnection(connection);
     return EXIT_SUCCESS;
 }
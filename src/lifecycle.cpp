@@ -0,0 +1,215 @@
+#include "lifecycle.h"
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <csignal>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define IDLE_POLL_INTERVAL 200 // ms between drain checks of an idle session
+
+std::atomic<bool> draining(false);
+std::atomic<int> activeSessions(0);
+
+static int drainPipe[2] = {-1, -1};
+
+// Function to wake the accept loop so it handles a flag set by a signal handler (async-signal-safe)
+void wakeAcceptLoop()
+{
+    char wake = 1;
+    if (write(drainPipe[1], &wake, 1) < 0)
+    {
+        // the accept loop still notices the flag on its next wakeup
+    }
+}
+
+// Function to start draining (async-signal-safe)
+void requestDrain()
+{
+    draining = true;
+    wakeAcceptLoop();
+}
+
+// Signal handler for SIGTERM
+static void handleTerminate(int)
+{
+    requestDrain();
+}
+
+// Function to install the SIGTERM handler, returns the fd the accept loop polls to notice a drain
+// or any other request of a signal handler (see wakeAcceptLoop)
+int initDrain()
+{
+    if (pipe(drainPipe) < 0)
+        return -1;
+
+    // SA_RESTART keeps blocking calls in the session threads from failing with EINTR
+    struct sigaction action = {};
+    action.sa_handler = handleTerminate;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, NULL);
+    return drainPipe[0];
+}
+
+// Function to wait until the client sends data, returns false if the server drains meanwhile
+bool waitForClient(int client_socket)
+{
+    pollfd client = {client_socket, POLLIN, 0};
+    while (!draining)
+    {
+        if (poll(&client, 1, IDLE_POLL_INTERVAL) != 0)
+            return true;
+    }
+    return false;
+}
+
+// Function to end a session the drain found idle, see lifecycle.h
+void sayGoodbye(int client_socket)
+{
+    send(client_socket, "BYE\n", 4, MSG_NOSIGNAL);
+    // closing with unread requests would reset the connection, the client could lose the BYE
+    shutdown(client_socket, SHUT_WR);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(BYE_LINGER);
+    char discard[1024];
+    pollfd client = {client_socket, POLLIN, 0};
+    while (true)
+    {
+        int remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0 || poll(&client, 1, remaining) <= 0 || recv(client_socket, discard, sizeof(discard), 0) <= 0)
+            break;
+    }
+}
+
+// Function to wait until all sessions have finished or DRAIN_TIMEOUT expired
+bool waitForSessions()
+{
+    auto deadline = std::chrono::steady_clock::now() + DRAIN_TIMEOUT;
+    while (activeSessions > 0 && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return activeSessions == 0;
+}
+
+// Function to fill in the address of the handoff socket
+static bool handoffAddress(const std::string &handoffPath, sockaddr_un &address)
+{
+    if (handoffPath.size() >= sizeof(address.sun_path))
+        return false;
+    address = {};
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, handoffPath.c_str());
+    return true;
+}
+
+// Function to take over the listening socket of a running server, returns -1 if there is none
+int receiveListeningSocket(const std::string &handoffPath)
+{
+    sockaddr_un address;
+    if (!handoffAddress(handoffPath, address))
+        return -1;
+
+    int handoff_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (handoff_socket < 0)
+        return -1;
+    if (connect(handoff_socket, (sockaddr *)&address, sizeof(address)) < 0)
+    {
+        close(handoff_socket);
+        return -1;
+    }
+
+    char data;
+    iovec io = {&data, 1};
+    char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr message = {};
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    int server_socket = -1;
+    if (recvmsg(handoff_socket, &message, 0) > 0)
+    {
+        cmsghdr *header = CMSG_FIRSTHDR(&message);
+        if (header != NULL && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+        {
+            memcpy(&server_socket, CMSG_DATA(header), sizeof(int));
+        }
+    }
+    close(handoff_socket);
+    return server_socket;
+}
+
+// Function to hand the listening socket to the first new server that connects, then start draining
+static void handoffListener(int handoff_socket, int server_socket)
+{
+    int successor = -1;
+    while (!draining && successor < 0)
+    {
+        pollfd listener = {handoff_socket, POLLIN, 0};
+        if (poll(&listener, 1, IDLE_POLL_INTERVAL) > 0)
+        {
+            successor = accept(handoff_socket, NULL, NULL);
+        }
+    }
+    close(handoff_socket);
+    if (successor < 0)
+        return;
+
+    char data = 1;
+    iovec io = {&data, 1};
+    char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr message = {};
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(header), &server_socket, sizeof(int));
+
+    if (sendmsg(successor, &message, 0) < 0)
+    {
+        perror("Handing over listening socket failed");
+        close(successor);
+        return;
+    }
+    close(successor);
+    std::cout << "Listening socket handed over, draining " << activeSessions << " session(s)\n";
+    requestDrain();
+}
+
+// Function to offer the listening socket to the next server started with the same handoff path
+bool startHandoffListener(const std::string &handoffPath, int server_socket)
+{
+    sockaddr_un address;
+    if (!handoffAddress(handoffPath, address))
+        return false;
+
+    int handoff_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (handoff_socket < 0)
+        return false;
+
+    // the predecessor (if any) is done with the path once it handed its socket over
+    unlink(handoffPath.c_str());
+    mode_t oldMask = umask(0077); // only the server's user may take over the socket
+    bool ok = bind(handoff_socket, (sockaddr *)&address, sizeof(address)) == 0 && listen(handoff_socket, 1) == 0;
+    umask(oldMask);
+    if (!ok)
+    {
+        close(handoff_socket);
+        return false;
+    }
+
+    std::thread listener(handoffListener, handoff_socket, server_socket);
+    listener.detach();
+    return true;
+}
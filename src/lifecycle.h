@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+// Graceful drain and hot restart.
+// SIGTERM (or a handoff to a new server) stops the accept loop; sessions finish the request
+// they are working on and are closed with BYE once they are idle. A new server started with the same
+// TWMAILER_HANDOFF_SOCKET takes over the listening socket from the running one (SCM_RIGHTS),
+// so no connection attempt is refused while the old process drains.
+
+#define DRAIN_TIMEOUT std::chrono::seconds(30) // max. time to wait for sessions to finish
+#define BYE_LINGER 1000                         // ms a drained session waits for the client to close
+
+extern std::atomic<bool> draining;
+extern std::atomic<int> activeSessions;
+
+// Function to install the SIGTERM handler, returns the fd the accept loop polls to notice a drain
+// or any other request of a signal handler (see wakeAcceptLoop)
+int initDrain();
+
+// Function to start draining (async-signal-safe)
+void requestDrain();
+
+// Function to wake the accept loop so it handles a flag set by a signal handler (async-signal-safe)
+void wakeAcceptLoop();
+
+// Function to wait until the client sends data, returns false if the server drains meanwhile
+bool waitForClient(int client_socket);
+
+// Function to end a session the drain found idle: "BYE\n" tells the client that none of the requests
+// it sent afterwards was handled (it may send them again on a new connection); the connection is
+// half closed and the caller closes it once the client has seen the BYE (or BYE_LINGER expired)
+void sayGoodbye(int client_socket);
+
+// Function to wait until all sessions have finished or DRAIN_TIMEOUT expired
+bool waitForSessions();
+
+// Function to take over the listening socket of a running server, returns -1 if there is none
+int receiveListeningSocket(const std::string &handoffPath);
+
+// Function to offer the listening socket to the next server started with the same handoff path
+bool startHandoffListener(const std::string &handoffPath, int server_socket);
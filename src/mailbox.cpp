@@ -0,0 +1,245 @@
+#include "mailbox.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#define NEXT_ID_FILE ".next"          // per-mailbox high-water mark of the message ids
+#define CHANGES_FILE ".changes"       // per-mailbox change counter
+#define MAX_STORE_ATTEMPTS 16         // ids tried before storing a message gives up
+
+// Function to add delta to the number in a counter file and return the value before, -1 on error
+// (initial() is used while the file is empty). The file is locked with flock, so every process
+// working on the spool, e.g. both servers during a hot restart, sees a consistent counter.
+static long long addToCounter(const std::string &file, long long delta, const std::function<long long()> &initial)
+{
+    int fd = open(file.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return -1;
+    flock(fd, LOCK_EX);
+    char text[32] = {};
+    ssize_t size = pread(fd, text, sizeof(text) - 1, 0);
+    long long value = size > 0 ? atoll(text) : initial();
+
+    // counters only grow, the new number always covers the old one completely
+    std::string updated = std::to_string(value + delta) + "\n";
+    bool ok = pwrite(fd, updated.data(), updated.size(), 0) == (ssize_t)updated.size();
+    close(fd); // releases the lock
+    return ok ? value : -1;
+}
+
+// Function to read a counter file, 0 if it does not exist
+static long long readCounter(const std::string &file)
+{
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+        return 0;
+    flock(fd, LOCK_SH);
+    char text[32] = {};
+    ssize_t size = pread(fd, text, sizeof(text) - 1, 0);
+    close(fd);
+    return size > 0 ? atoll(text) : 0;
+}
+
+// Function to reserve count consecutive message ids in a mailbox, returns the first one (0 on error)
+// The high-water mark in <userDir>/.next is kept across deletes, so an id is never handed out twice.
+// Mailboxes without one (older spools) continue after their highest existing id.
+int allocateMessageIds(const std::string &userDir, int count)
+{
+    long long nextId = addToCounter(userDir + "/" + NEXT_ID_FILE, count, [&]()
+                                    {
+        std::vector<int> ids = getMessageIds(userDir);
+        return ids.empty() ? 1LL : ids.back() + 1LL; });
+    return nextId > 0 ? (int)nextId : 0;
+}
+
+// Function to store a new message in a mailbox, returns its id (0 on error)
+// The file is created exclusively: an id that is taken anyway (by a writer that bypassed the
+// high-water mark) is skipped instead of overwriting the message stored under it.
+int storeMessage(const std::string &userDir, const std::string &content)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(userDir, ec);
+    for (int attempt = 0; attempt < MAX_STORE_ATTEMPTS; attempt++)
+    {
+        int id = allocateMessageIds(userDir);
+        if (id == 0)
+            return 0;
+        std::string messageFile = userDir + "/" + std::to_string(id) + ".msg";
+        int fd = open(messageFile.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd < 0 && errno == EEXIST)
+            continue;
+        if (fd < 0)
+            return 0;
+
+        size_t written = 0;
+        while (written < content.size())
+        {
+            ssize_t size = write(fd, content.data() + written, content.size() - written);
+            if (size <= 0)
+                break;
+            written += size;
+        }
+        close(fd);
+        if (written < content.size())
+        {
+            unlink(messageFile.c_str());
+            return 0;
+        }
+        return id;
+    }
+    return 0;
+}
+
+// Function to get the change counter of a mailbox (0 if it never changed)
+long long readChangeCounter(const std::string &userDir)
+{
+    return readCounter(userDir + "/" + CHANGES_FILE);
+}
+
+// Function to count a change of a mailbox
+void bumpChangeCounter(const std::string &userDir)
+{
+    addToCounter(userDir + "/" + CHANGES_FILE, 1, []()
+                 { return 0LL; });
+}
+
+// Function to get all message IDs of a mailbox in ascending order
+std::vector<int> getMessageIds(const std::string &userDir)
+{
+    std::vector<int> ids;
+    if (!std::filesystem::exists(userDir))
+    {
+        return ids;
+    }
+    for (const auto &entry : std::filesystem::directory_iterator(userDir))
+    {
+        if (entry.path().extension() == ".msg")
+        {
+            ids.push_back(std::stoi(entry.path().stem().string()));
+        }
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+// Function to check that a request parameter is a plain non-negative number
+bool isNumber(const std::string &value)
+{
+    if (value.empty() || value.length() > 9)
+        return false;
+    for (char c : value)
+    {
+        if (!isdigit(c))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Function to parse an id list like "1,3,7-12" into inclusive ranges
+bool parseIdRanges(const std::string &spec, std::vector<std::pair<int, int>> &ranges)
+{
+    std::istringstream specStream(spec);
+    std::string part;
+    while (std::getline(specStream, part, ','))
+    {
+        size_t dash = part.find('-');
+        std::string from = part.substr(0, dash);
+        std::string to = dash == std::string::npos ? from : part.substr(dash + 1);
+        if (!isNumber(from) || !isNumber(to) || std::stoi(from) > std::stoi(to))
+        {
+            return false;
+        }
+        ranges.emplace_back(std::stoi(from), std::stoi(to));
+    }
+    return !ranges.empty();
+}
+
+// Function to select the existing message ids covered by the given ranges
+std::vector<int> selectMessageIds(const std::string &userDir, const std::vector<std::pair<int, int>> &ranges)
+{
+    std::vector<int> selected;
+    for (int id : getMessageIds(userDir))
+    {
+        for (const auto &range : ranges)
+        {
+            if (id >= range.first && id <= range.second)
+            {
+                selected.push_back(id);
+                break;
+            }
+        }
+    }
+    return selected;
+}
+
+// Function to read the subject line of a stored message
+std::string readSubject(const std::string &messageFile)
+{
+    std::ifstream inFile(messageFile);
+    std::string line;
+
+    // Search for subject
+    while (std::getline(inFile, line))
+    {
+        if (line.rfind("Subject: ", 0) == 0) // Line that begins with subject
+        {
+            return line.substr(9); // extract subject
+        }
+    }
+    return "";
+}
+
+// Function to read a whole message file as stored on disk
+bool readMessageFile(const std::string &messageFile, std::string &content)
+{
+    std::ifstream inFile(messageFile, std::ios::binary);
+    if (!inFile)
+        return false;
+    content.assign(std::istreambuf_iterator<char>(inFile), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Function to build the lines of a LIST reply ("<id>: <subject>"), param1/param2 as for handleList
+// Returns false for malformed arguments
+bool listMessages(const std::string &userDir, const std::string &param1, const std::string &param2, std::string &lines, int &count)
+{
+    bool incremental = param1 != "";
+    if ((incremental && !isNumber(param1)) || (param2 != "" && !isNumber(param2)))
+        return false;
+
+    std::vector<int> ids = getMessageIds(userDir);
+
+    // Select the requested window before touching any message file
+    auto first = ids.begin();
+    auto last = ids.end();
+    if (param2 != "")
+    {
+        size_t offset = std::min<size_t>(std::stoi(param1), ids.size());
+        size_t limit = std::min<size_t>(std::stoi(param2), ids.size() - offset);
+        first = ids.begin() + offset;
+        last = first + limit;
+    }
+    else if (incremental)
+    {
+        first = std::upper_bound(ids.begin(), ids.end(), std::stoi(param1));
+    }
+
+    count = 0;
+    for (auto it = first; it != last; ++it)
+    {
+        count++;
+        std::string subject = readSubject(userDir + "/" + std::to_string(*it) + ".msg");
+        lines += std::to_string(*it) + ": " + subject + "\n";
+    }
+    return true;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+
+// Mailbox access on the spool (<mail-spool>/<user>/<id>.msg, the id high-water mark in <user>/.next
+// and a change counter in <user>/.changes).
+// Within a process the server calls these while holding mailDirMutex. Ids, message files and the change
+// counter are also safe against a second process on the same spool (flock, exclusive create), as during
+// a hot restart when the old server still finishes its sessions.
+
+// Function to reserve count consecutive message ids in a mailbox, returns the first one (0 on error)
+// Ids are never reused, deleting the newest message does not hand its id out again.
+int allocateMessageIds(const std::string &userDir, int count = 1);
+
+// Function to store a new message in a mailbox, returns its id (0 on error)
+// An existing message file is never overwritten, a taken id is skipped.
+int storeMessage(const std::string &userDir, const std::string &content);
+
+// Function to get the change counter of a mailbox (0 if it never changed)
+long long readChangeCounter(const std::string &userDir);
+
+// Function to count a change of a mailbox
+void bumpChangeCounter(const std::string &userDir);
+
+// Function to get all message IDs of a mailbox in ascending order
+std::vector<int> getMessageIds(const std::string &userDir);
+
+// Function to check that a request parameter is a plain non-negative number
+bool isNumber(const std::string &value);
+
+// Function to parse an id list like "1,3,7-12" into inclusive ranges
+bool parseIdRanges(const std::string &spec, std::vector<std::pair<int, int>> &ranges);
+
+// Function to select the existing message ids covered by the given ranges
+std::vector<int> selectMessageIds(const std::string &userDir, const std::vector<std::pair<int, int>> &ranges);
+
+// Function to read the subject line of a stored message
+std::string readSubject(const std::string &messageFile);
+
+// Function to read a whole message file as stored on disk
+bool readMessageFile(const std::string &messageFile, std::string &content);
+
+// Function to build the lines of a LIST reply ("<id>: <subject>"), param1/param2 as for handleList
+// Returns false for malformed arguments
+bool listMessages(const std::string &userDir, const std::string &param1, const std::string &param2, std::string &lines, int &count);
@@ -0,0 +1,265 @@
+#include "mailclient.h"
+#include "protocol.h"
+
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <sstream>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+// Function to read one line (including '\n') from the connection
+static bool readLine(MailConnection &connection, std::string &line)
+{
+    size_t lineEnd;
+    while ((lineEnd = connection.buffer.find('\n')) == std::string::npos)
+    {
+        char buffer[BUF];
+        int size = recv(connection.socket, buffer, BUF, 0);
+        if (size <= 0)
+            return false;
+        connection.buffer.append(buffer, size);
+    }
+    line = connection.buffer.substr(0, lineEnd + 1);
+    connection.buffer.erase(0, lineEnd + 1);
+    return true;
+}
+
+// Function to read exactly length bytes from the connection
+static bool readBytes(MailConnection &connection, size_t length, std::string &bytes)
+{
+    while (connection.buffer.size() < length)
+    {
+        char buffer[BUF];
+        int size = recv(connection.socket, buffer, BUF, 0);
+        if (size <= 0)
+            return false;
+        connection.buffer.append(buffer, size);
+    }
+    bytes = connection.buffer.substr(0, length);
+    connection.buffer.erase(0, length);
+    return true;
+}
+
+// Function to connect to the server and read its welcome line
+bool connectToServer(MailConnection &connection, const char *serverIp, int serverPort, std::string &welcome)
+{
+    sockaddr_in server_address = {};
+    server_address.sin_family = AF_INET;
+    server_address.sin_port = htons(serverPort);
+    if (!inet_aton(serverIp, &server_address.sin_addr))
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    if ((connection.socket = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+        return false;
+
+    if (connect(connection.socket, (sockaddr *)&server_address, sizeof(server_address)) == -1)
+    {
+        closeConnection(connection);
+        return false;
+    }
+    return readLine(connection, welcome);
+}
+
+// Function to close the connection
+void closeConnection(MailConnection &connection)
+{
+    if (connection.socket != -1)
+    {
+        close(connection.socket);
+        connection.socket = -1;
+    }
+    connection.buffer.clear();
+}
+
+// Function to validate the username
+bool validateUsername(const std::string &username)
+{
+    if (username.empty() || username.length() > 8)
+        return false;
+    for (char c : username)
+    {
+        if (!isalnum(c))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Function to validate the subject
+bool validateSubject(const std::string &subject)
+{
+    return subject.length() <= 80 && subject.find('\n') == std::string::npos;
+}
+
+// Function to build a request with one line per parameter
+std::string buildRequest(const std::string &command, const std::vector<std::string> &params)
+{
+    std::string request = command + "\n";
+    for (const auto &param : params)
+    {
+        request += param + "\n";
+    }
+    return request;
+}
+
+// Function to build a LIST request, args is empty, "<since-id>" or "<offset> <limit>"
+std::string buildListRequest(const std::string &args)
+{
+    std::istringstream argStream(args);
+    std::string request = "LIST", arg;
+    while (argStream >> arg)
+    {
+        request += " " + arg;
+    }
+    return request + "\n";
+}
+
+// Function to build a SEND request, message is the text without the terminating "."
+std::string buildSendRequest(const std::string &receiver, const std::string &subject, const std::string &message)
+{
+    std::string request = "SEND\n" + receiver + "\n" + subject + "\n" + message;
+    if (!message.empty() && message.back() != '\n')
+    {
+        request += "\n";
+    }
+    return request + ".\n";
+}
+
+// Function to split a stream of raw requests (e.g. a batch file) into single requests,
+// fails if the input ends with an unfinished request
+bool splitRequests(const std::string &input, std::vector<std::string> &requests)
+{
+    size_t pos = 0;
+    while (pos < input.size())
+    {
+        // skip blank (or whitespace only) lines between requests, the server does not answer them
+        size_t lineEnd = input.find('\n', pos);
+        if (input.find_first_not_of(" \t\r\f\v", pos) == lineEnd)
+        {
+            if (lineEnd == std::string::npos)
+                break;
+            pos = lineEnd + 1;
+            continue;
+        }
+        size_t requestEnd = findRequestEnd(input, pos);
+        if (requestEnd == 0)
+        {
+            // tolerate a missing newline at the very end
+            std::string last = input.substr(pos) + "\n";
+            if (findRequestEnd(last) != last.size())
+                return false;
+            requests.push_back(last);
+            break;
+        }
+        requests.push_back(input.substr(pos, requestEnd - pos));
+        pos = requestEnd;
+    }
+    return true;
+}
+
+// Function to send a request to the server
+bool sendRequest(MailConnection &connection, const std::string &request)
+{
+    return sendAll(connection.socket, request);
+}
+
+// Function to receive the complete reply to the given request
+// Every reply starts with a status line; what follows depends on the command:
+// LOGIN/RESUME/STAT "OK" + one line, LIST "<count>: <generation>" + count lines,
+// READ lines up to ".", MREAD/MDEL "OK" + count line (+ count length framed messages,
+// length 0 for a message deleted while the reply was sent)
+bool receiveReply(MailConnection &connection, const std::string &request, std::string &reply)
+{
+    std::string command = getCommand(request);
+    std::string line;
+    if (!readLine(connection, line))
+        return false;
+    if (line == "BYE\n")
+    {
+        connection.closedByServer = true;
+        return false;
+    }
+    reply = line;
+    if (line.rfind("ERR", 0) == 0)
+        return true;
+
+    if (command == "LOGIN" || command == "RESUME" || command == "STAT" || command == "MDEL")
+    {
+        if (!readLine(connection, line))
+            return false;
+        reply += line;
+    }
+    else if (command == "LIST")
+    {
+        int count = std::stoi(line);
+        for (int i = 0; i < count; i++)
+        {
+            if (!readLine(connection, line))
+                return false;
+            reply += line;
+        }
+    }
+    else if (command == "READ")
+    {
+        while (line != ".\n")
+        {
+            if (!readLine(connection, line))
+                return false;
+            reply += line;
+        }
+    }
+    else if (command == "MREAD")
+    {
+        if (!readLine(connection, line))
+            return false;
+        reply += line;
+        int count = std::stoi(line);
+        for (int i = 0; i < count; i++)
+        {
+            std::string message;
+            if (!readLine(connection, line) || !readBytes(connection, std::stoul(line.substr(line.find(' ') + 1)), message))
+                return false;
+            reply += line + message;
+        }
+    }
+    return true;
+}
+
+// Function to send requests in batches of PIPELINE_DEPTH (at most PIPELINE_BYTES, a larger request goes alone)
+// per round-trip and collect their replies in order.
+// A batch that fits into the socket buffers is written completely even while the server is blocked writing
+// large replies nobody reads yet; a larger one could leave both sides blocked in send.
+bool sendPipelined(MailConnection &connection, const std::vector<std::string> &requests, std::vector<std::string> &replies)
+{
+    for (size_t first = 0, last = 0; first < requests.size(); first = last)
+    {
+        std::string batch;
+        while (last < requests.size() && last - first < PIPELINE_DEPTH &&
+               (last == first || batch.size() + requests[last].size() <= PIPELINE_BYTES))
+        {
+            batch += requests[last++];
+        }
+        if (!sendRequest(connection, batch))
+            return false;
+
+        for (size_t i = first; i < last; i++)
+        {
+            // QUIT is the only request without a reply
+            if (getCommand(requests[i]) == "QUIT")
+                return true;
+            std::string reply;
+            if (!receiveReply(connection, requests[i], reply))
+                return false;
+            replies.push_back(reply);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#define PIPELINE_DEPTH 32          // max. requests written before their replies are read
+#define PIPELINE_BYTES (64 * 1024) // max. bytes of requests written before their replies are read
+
+// Connection to a twmailer server
+struct MailConnection
+{
+    int socket = -1;
+    std::string buffer; // received bytes that do not belong to a finished reply yet
+    bool closedByServer = false; // the server ended the session with BYE (draining), the requests
+                                 // that got no reply were not handled and may be sent again
+};
+
+// Function to connect to the server and read its welcome line
+bool connectToServer(MailConnection &connection, const char *serverIp, int serverPort, std::string &welcome);
+
+// Function to close the connection
+void closeConnection(MailConnection &connection);
+
+// Function to validate the username
+bool validateUsername(const std::string &username);
+
+// Function to validate the subject
+bool validateSubject(const std::string &subject);
+
+// Functions to build the wire format of a request
+std::string buildRequest(const std::string &command, const std::vector<std::string> &params);
+std::string buildListRequest(const std::string &args);
+std::string buildSendRequest(const std::string &receiver, const std::string &subject, const std::string &message);
+
+// Function to split a stream of raw requests (e.g. a batch file) into single requests,
+// fails if the input ends with an unfinished request
+bool splitRequests(const std::string &input, std::vector<std::string> &requests);
+
+// Function to send a request to the server
+bool sendRequest(MailConnection &connection, const std::string &request);
+
+// Function to receive the complete reply to the given request, fails on BYE (see closedByServer)
+// (after "CAPA deflate" MREAD may return stored messages as is, decode them with decodeMessage() from message.h)
+bool receiveReply(MailConnection &connection, const std::string &request, std::string &reply);
+
+// Function to send requests in batches of PIPELINE_DEPTH (at most PIPELINE_BYTES, a larger request goes alone)
+// per round-trip and collect their replies in order
+bool sendPipelined(MailConnection &connection, const std::vector<std::string> &requests, std::vector<std::string> &replies);
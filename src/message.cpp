@@ -0,0 +1,69 @@
+#include "message.h"
+
+#include <sstream>
+#include <zlib.h>
+
+// Function to (de)compress a message body with zlib, level 1 favours speed over ratio
+bool compressBody(const std::string &body, std::string &compressed)
+{
+    uLongf size = compressBound(body.size());
+    compressed.resize(size);
+    if (compress2((Bytef *)&compressed[0], &size, (const Bytef *)body.data(), body.size(), Z_BEST_SPEED) != Z_OK)
+        return false;
+    compressed.resize(size);
+    return true;
+}
+
+bool decompressBody(const std::string &compressed, size_t originalSize, std::string &body)
+{
+    // deflate cannot expand more than ~1032:1, anything beyond is a corrupt header
+    if (originalSize > compressed.size() * 1032 + 64)
+        return false;
+
+    uLongf size = originalSize;
+    body.resize(originalSize);
+    if (uncompress((Bytef *)&body[0], &size, (const Bytef *)compressed.data(), compressed.size()) != Z_OK || size != originalSize)
+        return false;
+    return true;
+}
+
+// Function to build the file content of a message, bodies of at least threshold bytes are compressed
+// (a threshold of 0 disables compression)
+std::string encodeMessage(const std::string &sender, const std::string &subject, const std::string &body, size_t threshold)
+{
+    std::string header = "Sender: " + sender + "\n" + "Subject: " + subject + "\n";
+    std::string compressed;
+    if (threshold > 0 && body.size() >= threshold && compressBody(body, compressed) && compressed.size() < body.size())
+    {
+        return header + "Encoding: deflate " + std::to_string(body.size()) + "\n" + "Message:\n" + compressed;
+    }
+    return header + "Message:\n" + body;
+}
+
+// Function to turn stored file content into the plain text form clients expect
+bool decodeMessage(const std::string &content, std::string &plain)
+{
+    const std::string encodingTag = "\nEncoding: deflate ";
+    const std::string messageTag = "\nMessage:\n";
+
+    size_t messagePos = content.find(messageTag);
+    size_t encodingPos = content.find(encodingTag);
+    if (messagePos == std::string::npos || encodingPos == std::string::npos || encodingPos > messagePos)
+    {
+        // stored uncompressed
+        plain = content;
+        return true;
+    }
+
+    size_t originalSize = 0;
+    std::istringstream sizeStream(content.substr(encodingPos + encodingTag.size(), messagePos - encodingPos - encodingTag.size()));
+    if (!(sizeStream >> originalSize))
+        return false;
+
+    std::string body;
+    if (!decompressBody(content.substr(messagePos + messageTag.size()), originalSize, body))
+        return false;
+
+    plain = content.substr(0, encodingPos) + messageTag + body;
+    return true;
+}
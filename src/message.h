@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+
+// Stored message format:
+//   Sender: <sender>
+//   Subject: <subject>
+//   [Encoding: deflate <original-size>]
+//   Message:
+//   <body, zlib compressed if an Encoding line is present>
+
+// Function to build the file content of a message, bodies of at least threshold bytes are compressed
+// (a threshold of 0 disables compression)
+std::string encodeMessage(const std::string &sender, const std::string &subject, const std::string &body, size_t threshold);
+
+// Function to turn stored file content into the plain text form clients expect
+bool decodeMessage(const std::string &content, std::string &plain);
+
+// Functions to (de)compress a message body with zlib
+bool compressBody(const std::string &body, std::string &compressed);
+bool decompressBody(const std::string &compressed, size_t originalSize, std::string &body);
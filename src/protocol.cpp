@@ -0,0 +1,162 @@
+#include "protocol.h"
+
+#include <sstream>
+#include <algorithm>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Function to get the number of parameter lines a command expects
+int getParameterCount(const std::string &command)
+{
+    if (command == "LOGIN" || command == "SEND")
+        return 2;
+    if (command == "RESUME" || command == "FROM" || command == "CAPA" || command == "READ" || command == "DEL" || command == "MREAD" || command == "MDEL")
+        return 1;
+    return 0;
+}
+
+// Function to continue framing with the bytes added to buffer since the last call,
+// returns the end of the request or 0 if it is not complete yet (reset state after a complete one)
+size_t findRequestEnd(const std::string &buffer, FramingState &state)
+{
+    while (true)
+    {
+        size_t lineEnd = buffer.find('\n', std::max(state.pos, state.searched));
+        if (lineEnd == std::string::npos)
+        {
+            state.searched = buffer.size();
+            return 0;
+        }
+        size_t lineStart = state.pos;
+        state.pos = lineEnd + 1;
+
+        if (!state.commandSeen)
+        {
+            std::istringstream commandLine(buffer.substr(lineStart, lineEnd - lineStart));
+            std::string command, arg;
+            int inlineArgs = 0;
+            commandLine >> command;
+            while (commandLine >> arg)
+            {
+                inlineArgs++;
+            }
+
+            // SEND is always sent line by line since the subject may contain spaces
+            state.commandSeen = true;
+            state.inMessage = command == "SEND";
+            state.parameterLines = getParameterCount(command);
+            if (!state.inMessage)
+            {
+                state.parameterLines = inlineArgs >= state.parameterLines ? 0 : state.parameterLines - inlineArgs;
+            }
+        }
+        else if (state.parameterLines > 0)
+        {
+            state.parameterLines--;
+        }
+        else
+        {
+            // message lines until the terminating "."
+            state.inMessage = buffer.compare(lineStart, lineEnd - lineStart, ".") != 0;
+        }
+
+        if (state.parameterLines == 0 && !state.inMessage)
+            return state.pos;
+    }
+}
+
+// Function to find the end of the request starting at start, returns 0 if it is not complete yet
+size_t findRequestEnd(const std::string &buffer, size_t start)
+{
+    FramingState state;
+    state.pos = start;
+    return findRequestEnd(buffer, state);
+}
+
+// Function to receive the next complete request. Fails if the peer closed the connection, the
+// unfinished request grew beyond maxSize or waitForData (called while no bytes are pending) fails
+bool readRequest(RequestReader &reader, std::string &request, size_t maxSize, bool (*waitForData)(int socket))
+{
+    char buffer[BUF];
+    while (true)
+    {
+        size_t requestEnd = findRequestEnd(reader.pending, reader.framing);
+        if (requestEnd != 0)
+        {
+            request = reader.pending.substr(0, requestEnd);
+            reader.pending.erase(0, requestEnd);
+            reader.framing = FramingState();
+            return true;
+        }
+        if (reader.pending.size() > maxSize)
+            return false;
+        if (reader.pending.empty() && waitForData != NULL && !waitForData(reader.socket))
+            return false;
+        int size = recv(reader.socket, buffer, BUF, 0);
+        if (size <= 0)
+            return false;
+        reader.pending.append(buffer, size);
+    }
+}
+
+// Function to extract the command word of a request
+std::string getCommand(const std::string &request)
+{
+    std::istringstream requestStream(request);
+    std::string command;
+    requestStream >> command;
+    return command;
+}
+
+// Function to split one complete request into its parts
+Request parseRequest(const std::string &text)
+{
+    Request request;
+    std::istringstream requestStream(text);
+    requestStream >> request.command >> request.param1 >> std::ws;
+    std::getline(requestStream, request.param2);
+    std::getline(requestStream, request.message, '\0');
+    return request;
+}
+
+// Function to get the user of a session token "<uid>.<expiry>.<hmac>", empty if it is malformed
+std::string getTokenUser(const std::string &token)
+{
+    size_t macDot = token.rfind('.');
+    if (macDot == std::string::npos || macDot == 0)
+        return "";
+    size_t expiryDot = token.rfind('.', macDot - 1);
+    if (expiryDot == std::string::npos)
+        return "";
+    return token.substr(0, expiryDot);
+}
+
+// Function to retrieve IP address of client_socket
+std::string getClientIP(int client_socket)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    if (getpeername(client_socket, (struct sockaddr *)&addr, &addr_len) == 0)
+    {
+        return inet_ntoa(addr.sin_addr); // Return client IP
+    }
+    return "unknown";
+}
+
+// Function to send a whole buffer, even if the kernel accepts it in pieces
+// (a peer that reset the connection yields false instead of a SIGPIPE)
+bool sendAll(int socket, const std::string &data)
+{
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t size = send(socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (size <= 0)
+        {
+            return false;
+        }
+        sent += size;
+    }
+    return true;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+
+// Request framing shared by server and client.
+// A request is its command line plus the parameter lines the command expects;
+// SEND additionally carries a message that ends with a line containing only ".".
+// Parameters may also be given on the command line itself (e.g. "READ 3"),
+// LIST takes its optional arguments only that way (e.g. "LIST 0 20").
+
+// Function to get the number of parameter lines a command expects
+int getParameterCount(const std::string &command);
+
+#define BUF 1024                            // bytes read from a socket at once
+#define MAX_REQUEST_SIZE (16 * 1024 * 1024) // connections with a larger unfinished request are closed
+#define MAX_LOGIN_REQUEST_SIZE 1024         // same before the session is logged in
+
+// Framing progress of the request at the start of a buffer, lets a partly received request
+// be framed further without scanning it from its start again
+struct FramingState
+{
+    size_t pos = 0;           // start of the first line not examined yet
+    size_t searched = 0;      // the bytes from pos up to here contain no '\n'
+    bool commandSeen = false;
+    int parameterLines = 0;   // parameter lines still expected
+    bool inMessage = false;   // within a SEND message, before its "." line
+};
+
+// Function to continue framing with the bytes added to buffer since the last call,
+// returns the end of the request or 0 if it is not complete yet (reset state after a complete one)
+size_t findRequestEnd(const std::string &buffer, FramingState &state);
+
+// Function to find the end of the request starting at start, returns 0 if it is not complete yet
+size_t findRequestEnd(const std::string &buffer, size_t start = 0);
+
+// Receive side of a connection: bytes not handled yet (may hold several pipelined requests)
+// and how far the first of them is framed
+struct RequestReader
+{
+    int socket = -1;
+    std::string pending;
+    FramingState framing;
+};
+
+// Function to receive the next complete request. Fails if the peer closed the connection, the
+// unfinished request grew beyond maxSize or waitForData (called while no bytes are pending) fails
+bool readRequest(RequestReader &reader, std::string &request, size_t maxSize, bool (*waitForData)(int socket));
+
+// Function to extract the command word of a request
+std::string getCommand(const std::string &request);
+
+// A request split into its parts the way the server reads them:
+// command and param1 are single words, param2 is the rest of the following line and
+// message everything after it (the SEND body including its terminating ".")
+struct Request
+{
+    std::string command, param1, param2, message;
+};
+
+// Function to split one complete request into its parts
+Request parseRequest(const std::string &text);
+
+// Function to get the user of a session token "<uid>.<expiry>.<hmac>", empty if it is malformed
+// (split at the last two dots since a uid like "john.doe" may contain dots itself)
+std::string getTokenUser(const std::string &token);
+
+// Function to retrieve IP address of client_socket
+std::string getClientIP(int client_socket);
+
+// Function to send a whole buffer, even if the kernel accepts it in pieces
+bool sendAll(int socket, const std::string &data);
@@ -0,0 +1,294 @@
+#include "proxy.h"
+#include "protocol.h"
+#include "mailclient.h"
+#include "lifecycle.h"
+#include "ring.h"
+
+#include <iostream>
+#include <sstream>
+#include <map>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+
+#define MAX_IDLE_CONNECTIONS 16 // pooled connections kept open per backend
+
+std::mutex ringMutex;
+std::map<uint64_t, std::string> hashRing; // ring position -> "<ip>:<port>"
+std::string backendFile;
+std::atomic<bool> backendReloadRequested(false);
+
+std::mutex poolMutex;
+std::unordered_map<std::string, std::vector<MailConnection>> connectionPool;
+
+// Function to load the backend list ("<ip>:<port>" per line) and rebuild the hash ring
+bool loadBackends(const std::string &file)
+{
+    std::map<std::string, std::string> backends;
+    if (!readBackendFile(file, backends))
+        return false;
+    std::map<uint64_t, std::string> ring = buildRing(backends);
+
+    ringMutex.lock();
+    backendFile = file;
+    hashRing.swap(ring);
+    ringMutex.unlock();
+
+    // close pooled connections of backends that left the ring
+    poolMutex.lock();
+    for (auto it = connectionPool.begin(); it != connectionPool.end();)
+    {
+        if (backends.count(it->first))
+        {
+            ++it;
+            continue;
+        }
+        for (auto &connection : it->second)
+        {
+            closeConnection(connection);
+        }
+        it = connectionPool.erase(it);
+    }
+    poolMutex.unlock();
+
+    std::cout << "Routing over " << backends.size() << " backend(s) from " << file << "\n";
+    return true;
+}
+
+// Signal handler for SIGHUP, the ring is rebuilt from the backend file on the next request
+void requestBackendReload(int)
+{
+    backendReloadRequested = true;
+}
+
+// Function to find the backend that owns a mailbox
+static std::string routeTo(const std::string &user)
+{
+    if (backendReloadRequested.exchange(false))
+    {
+        ringMutex.lock();
+        std::string file = backendFile;
+        ringMutex.unlock();
+        if (!loadBackends(file))
+        {
+            std::cerr << "Reloading " << file << " failed, keeping the old ring\n";
+        }
+    }
+
+    ringMutex.lock();
+    std::string backend = findOwner(hashRing, user);
+    ringMutex.unlock();
+    return backend;
+}
+
+// Function to close all pooled connections to a backend
+static void dropConnections(const std::string &backend)
+{
+    poolMutex.lock();
+    std::vector<MailConnection> idle;
+    idle.swap(connectionPool[backend]);
+    poolMutex.unlock();
+    for (auto &connection : idle)
+    {
+        closeConnection(connection);
+    }
+}
+
+// Function to take a pooled connection to the backend or open a new one
+// (pooled connections are logged in already, LOGIN needs a fresh one)
+static bool acquireConnection(const std::string &backend, MailConnection &connection, bool fresh)
+{
+    bool pooled = false;
+    poolMutex.lock();
+    auto &idle = connectionPool[backend];
+    if (!fresh && !idle.empty())
+    {
+        connection = idle.back();
+        idle.pop_back();
+        pooled = true;
+    }
+    poolMutex.unlock();
+
+    if (pooled)
+    {
+        // an idle connection has nothing to read unless the backend closed it, e.g. on a restart;
+        // then the rest of its pool is stale as well and a new connection is opened
+        pollfd idleSocket = {connection.socket, POLLIN, 0};
+        if (poll(&idleSocket, 1, 0) == 0)
+            return true;
+        closeConnection(connection);
+        dropConnections(backend);
+    }
+
+    size_t colon = backend.rfind(':');
+    std::string welcome;
+    return connectToServer(connection, backend.substr(0, colon).c_str(), std::stoi(backend.substr(colon + 1)), welcome);
+}
+
+// Function to return a healthy connection to the pool
+static void releaseConnection(const std::string &backend, MailConnection &connection)
+{
+    poolMutex.lock();
+    auto &idle = connectionPool[backend];
+    if (idle.size() < MAX_IDLE_CONNECTIONS)
+    {
+        idle.push_back(connection);
+        connection = MailConnection();
+    }
+    poolMutex.unlock();
+    closeConnection(connection);
+}
+
+// Function to relay one request to a backend, a non-empty token first switches the pooled
+// connection to the client's session (both go out in one write).
+// A LOGIN is relayed with the client's address on a fresh connection.
+static bool relay(const std::string &backend, const std::string &token, const std::string &request, std::string &reply, const std::string &clientIP = "")
+{
+    std::vector<std::string> requests;
+    if (token != "")
+    {
+        requests.push_back(buildRequest("RESUME", {token}));
+    }
+    requests.push_back(request);
+
+    // a draining backend says BYE before it reads the request, that allows one more attempt
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        MailConnection connection;
+        if (!acquireConnection(backend, connection, clientIP != ""))
+            return false;
+
+        // the backend rate limits failed logins per client address, without FROM every client
+        // would share the proxy's address and anyone could lock a user out of the cluster
+        if (clientIP != "")
+        {
+            std::string from = buildRequest("FROM", {clientIP});
+            std::string fromReply;
+            if (!sendRequest(connection, from) || !receiveReply(connection, from, fromReply) || fromReply != "OK\n")
+            {
+                bool notHandled = connection.closedByServer;
+                closeConnection(connection);
+                if (notHandled)
+                    continue;
+                std::cerr << "Backend " << backend << " refused FROM, is TWMAILER_TRUSTED_PROXY set there?\n";
+                return false;
+            }
+        }
+
+        std::vector<std::string> replies;
+        if (!sendPipelined(connection, requests, replies))
+        {
+            bool notHandled = connection.closedByServer;
+            closeConnection(connection);
+            dropConnections(backend);
+            // otherwise no retry: the backend may have handled a SEND/DEL/MDEL before the connection broke
+            if (notHandled)
+                continue;
+            return false;
+        }
+
+        if (token != "")
+        {
+            if (replies[0].rfind("OK\n", 0) != 0)
+            {
+                // the backend logged the connection out, it is not handed to the next client
+                closeConnection(connection);
+                reply = "ERR Session expired\n";
+                return true;
+            }
+        }
+        releaseConnection(backend, connection);
+        reply = replies.back();
+        return true;
+    }
+    return false;
+}
+
+// Function for the client communication in proxy mode
+void proxyCommunication(int client_socket)
+{
+    send(client_socket, "Welcome to the server!\n", 23, 0);
+
+    RequestReader reader;
+    reader.socket = client_socket;
+
+    std::string sessionUsername = "";
+    std::string sessionToken = "";
+
+    std::string request;
+    while (readRequest(reader, request, sessionUsername == "" ? MAX_LOGIN_REQUEST_SIZE : MAX_REQUEST_SIZE, waitForClient))
+    {
+        std::istringstream requestStream(request);
+        std::string command, param1;
+        requestStream >> command >> param1;
+
+        std::string reply;
+        bool relayed = true;
+        if (command == "")
+        {
+            continue;
+        }
+        else if (command == "QUIT")
+        {
+            break;
+        }
+        else if (command == "LOGIN" && sessionUsername != "")
+        {
+            reply = "ERR Already logged in\n";
+        }
+        else if (command == "LOGIN" || command == "RESUME")
+        {
+            // param1 = username or token
+            std::string user = command == "LOGIN" ? param1 : getTokenUser(param1);
+            relayed = relay(routeTo(user), "", request, reply, command == "LOGIN" ? getClientIP(client_socket) : "");
+            if (relayed && reply.rfind("OK\n", 0) == 0)
+            {
+                sessionToken = reply.substr(3, reply.size() - 4);
+                sessionUsername = getTokenUser(sessionToken);
+            }
+        }
+        else if (command == "CAPA" || command == "FROM")
+        {
+            // pooled backend connections are shared, compressed pass-through is not offered;
+            // FROM is only sent by the proxy itself
+            reply = "ERR\n";
+        }
+        else if (getParameterCount(command) == 0 && command != "LIST" && command != "STAT")
+        {
+            reply = "ERR\n";
+        }
+        else if (sessionUsername == "")
+        {
+            reply = "ERR Login first\n";
+        }
+        else
+        {
+            // SEND is stored in the receiver's mailbox, everything else works on the own one
+            std::string owner = command == "SEND" ? param1 : sessionUsername;
+            relayed = relay(routeTo(owner), sessionToken, request, reply);
+            if (relayed && reply == "ERR Session expired\n")
+            {
+                // the token of the LOGIN ran out, the client has to LOGIN again
+                sessionUsername = "";
+                sessionToken = "";
+            }
+        }
+
+        if (!relayed)
+        {
+            reply = "ERR Backend unavailable\n";
+        }
+        sendAll(client_socket, reply);
+    }
+    if (draining)
+    {
+        sayGoodbye(client_socket);
+    }
+    close(client_socket);
+    activeSessions--;
+}
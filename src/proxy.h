@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+// Front-end proxy mode: mailboxes are spread over several twmailer backends by consistent
+// hashing of the user name. The backends must share TWMAILER_SESSION_KEY because the proxy
+// replays the session token on pooled backend connections.
+
+// Function to load the backend list ("<ip>:<port>" per line, see ring.h) and rebuild the hash ring
+bool loadBackends(const std::string &backendFile);
+
+// Signal handler for SIGHUP, the ring is rebuilt from the backend file on the next request
+void requestBackendReload(int);
+
+// Function for the client communication in proxy mode
+void proxyCommunication(int client_socket);
@@ -0,0 +1,60 @@
+#include "ratelimit.h"
+
+#include <unordered_map>
+#include <chrono>
+#include <mutex>
+
+std::mutex loginMutex;
+
+std::unordered_map<std::string, int> loginFailCount;
+std::unordered_map<std::string, std::chrono::steady_clock::time_point> lastLoginAttempt;
+
+// check if ip + username is blacklisted
+bool isBlacklisted(const std::string &key)
+{
+    loginMutex.lock();
+    auto it = loginFailCount.find(key);
+    if (it != loginFailCount.end())
+    {
+        auto now = std::chrono::steady_clock::now();
+
+        // Check if more than 3 fails and the blacklist time has not expired
+        if (it->second >= 3 && now - lastLoginAttempt[key] <= std::chrono::minutes(1))
+        {
+            loginMutex.unlock();
+            return true;
+        }
+
+        // erase if 1 minute has expired
+        if (now - lastLoginAttempt[key] > std::chrono::minutes(1))
+        {
+            loginFailCount.erase(it);
+        }
+    }
+
+    loginMutex.unlock();
+    return false;
+}
+
+// Function to count a failed login, returns true if ip + username is now blacklisted
+bool registerLoginFailure(const std::string &key)
+{
+    loginMutex.lock();
+    (loginFailCount[key])++;
+    lastLoginAttempt[key] = std::chrono::steady_clock::now();
+    bool blacklisted = loginFailCount[key] >= 3;
+    loginMutex.unlock();
+    return blacklisted;
+}
+
+// Function to reset the failed login counter after a successful login
+void clearLoginFailures(const std::string &key)
+{
+    loginMutex.lock();
+    auto it = loginFailCount.find(key);
+    if (it != loginFailCount.end())
+    {
+        loginFailCount.erase(it); // Remove entry after successful log in
+    }
+    loginMutex.unlock();
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+
+// Login rate limiting: 3 failed logins of one ip + username blacklist it for 1 minute.
+// The key is "<ip>_<username>".
+
+// check if ip + username is blacklisted
+bool isBlacklisted(const std::string &key);
+
+// Function to count a failed login, returns true if ip + username is now blacklisted
+bool registerLoginFailure(const std::string &key);
+
+// Function to reset the failed login counter after a successful login
+void clearLoginFailures(const std::string &key);
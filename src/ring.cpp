@@ -0,0 +1,67 @@
+#include "ring.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+// Function to hash a key onto the ring (FNV-1a, stable across processes and restarts)
+static uint64_t hashKey(const std::string &key)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : key)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Function to read the backend file into backend -> spool directory (empty if not given)
+bool readBackendFile(const std::string &file, std::map<std::string, std::string> &backends)
+{
+    std::ifstream inFile(file);
+    if (!inFile)
+        return false;
+
+    std::string line;
+    while (std::getline(inFile, line))
+    {
+        std::istringstream lineStream(line);
+        std::string backend, spoolDir;
+        if (!(lineStream >> backend) || backend[0] == '#')
+            continue;
+        if (backend.find(':') == std::string::npos)
+        {
+            std::cerr << "Invalid backend " << backend << ", expected <ip>:<port>\n";
+            return false;
+        }
+        lineStream >> spoolDir;
+        backends[backend] = spoolDir;
+    }
+    return !backends.empty();
+}
+
+// Function to build the hash ring of the given backends
+std::map<uint64_t, std::string> buildRing(const std::map<std::string, std::string> &backends)
+{
+    std::map<uint64_t, std::string> ring;
+    for (const auto &backend : backends)
+    {
+        for (int i = 0; i < VIRTUAL_NODES; i++)
+        {
+            ring[hashKey(backend.first + "#" + std::to_string(i))] = backend.first;
+        }
+    }
+    return ring;
+}
+
+// Function to find the backend that owns a mailbox
+std::string findOwner(const std::map<uint64_t, std::string> &ring, const std::string &user)
+{
+    auto it = ring.lower_bound(hashKey(user));
+    if (it == ring.end())
+    {
+        it = ring.begin();
+    }
+    return it->second;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <cstdint>
+
+// Consistent hash ring of the proxy: every backend "<ip>:<port>" is placed at VIRTUAL_NODES
+// positions, a mailbox belongs to the first backend at or after the hash of its user name.
+// The backend file lists one backend per line, optionally followed by its spool directory
+// (only spooltool rebalance needs that one). Lines starting with '#' are comments.
+
+#define VIRTUAL_NODES 64 // ring positions per backend, smooths the distribution
+
+// Function to read the backend file into backend -> spool directory (empty if not given)
+bool readBackendFile(const std::string &file, std::map<std::string, std::string> &backends);
+
+// Function to build the hash ring of the given backends
+std::map<uint64_t, std::string> buildRing(const std::map<std::string, std::string> &backends);
+
+// Function to find the backend that owns a mailbox
+std::string findOwner(const std::map<uint64_t, std::string> &ring, const std::string &user);
@@ -5,8 +5,11 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <filesystem>
 #include <fstream>
 #include <ldap.h>
@@ -15,83 +18,297 @@
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <atomic>
+#include "protocol.h"
+#include "message.h"
+#include "proxy.h"
+#include "lifecycle.h"
+#include "mailbox.h"
+#include "ratelimit.h"
+
+#define SESSION_TOKEN_TTL 3600 // seconds a RESUME token stays valid
+#define CREDENTIAL_CACHE_SIZE 1024 // max. users kept in the credential cache
+#define CREDENTIAL_CACHE_TTL std::chrono::minutes(5)
+#define CREDENTIAL_CACHE_NEGATIVE_TTL std::chrono::seconds(30)
 
-#define BUF 1024
-
-std::mutex loginMutex;
 std::mutex mailDirMutex;
 
-std::unordered_map<std::string, int> loginFailCount;
-std::unordered_map<std::string, std::chrono::steady_clock::time_point> lastLoginAttempt;
+// Cached LDAP verification result of one user, passwords are only kept as salted hashes
+struct CredentialCacheEntry
+{
+    std::string salt;
+    std::string validHash; // hash of the last password LDAP accepted
+    std::string uid;
+    std::chrono::steady_clock::time_point validUntil;
+    std::string invalidHash; // hash of the last password LDAP rejected
+    std::chrono::steady_clock::time_point invalidUntil;
+};
+
+std::mutex credentialCacheMutex;
+std::unordered_map<std::string, CredentialCacheEntry> credentialCache;
+std::atomic<unsigned long> credentialCacheHits(0);
+std::atomic<unsigned long> credentialCacheMisses(0);
+std::atomic<bool> credentialCacheFlushRequested(false);
+std::atomic<bool> credentialCacheStatsRequested(false);
+
+// Bodies of at least this many bytes are stored compressed, 0 = off (TWMAILER_COMPRESSION_THRESHOLD)
+size_t compressionThreshold = 0;
+
+// Key used to sign session tokens, set once in main()
+std::string sessionKey;
+
+// Mailbox generation: the change counter in the spool (bumped on every SEND/DEL, see mailbox.h), so a server
+// sharing the spool during a hot restart reports the changes made through the other one as well.
+// The reported generation carries the server start time in its upper 32 bits so
+// that a restart never hands out a value a client may still have cached.
+const uint64_t generationEpoch = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+                                                           std::chrono::system_clock::now().time_since_epoch())
+                                                           .count())
+                                 << 32;
 
 // Function to show the usage of the program
 void showUsage(const char *programName)
 {
-    std::cout << "Usage: " << programName << " <port> <mail-spool-directoryname>\n";
+    std::cout << "Usage: " << programName << " <port> <mail-spool-directoryname>\n"
+              << "       " << programName << " <port> --proxy <backend-file>\n"
+              << "In proxy mode mailboxes are routed to the backends listed in the file (\"<ip>:<port>\" per line).\n"
+              << "TWMAILER_COMPRESSION_THRESHOLD=<bytes> stores message bodies of at least that size compressed (0 = off).\n";
+}
+
+// Function to get the current generation of a mailbox (caller holds mailDirMutex)
+uint64_t getGeneration(const std::string &userDir)
+{
+    return generationEpoch | static_cast<uint32_t>(readChangeCounter(userDir));
+}
+
+// Function to mark a mailbox as changed (caller holds mailDirMutex)
+void bumpGeneration(const std::string &userDir)
+{
+    bumpChangeCounter(userDir);
 }
 
-// Function to get the next message ID by extracting the number from the message file name
-int getNextMessageId(const std::string &userDir)
+// Function to load the session key from TWMAILER_SESSION_KEY or generate a random one
+// (a random key invalidates all tokens when the server restarts)
+bool initSessionKey()
 {
-    int maxId = 0;
-    for (const auto &entry : std::filesystem::directory_iterator(userDir))
+    const char *configuredKey = getenv("TWMAILER_SESSION_KEY");
+    if (configuredKey != NULL && configuredKey[0] != '\0')
     {
-        if (entry.path().extension() == ".msg")
-        {
-            std::string filename = entry.path().stem().string();
-            int id = std::stoi(filename);
-            if (id > maxId)
-            {
-                maxId = id;
-            }
-        }
+        sessionKey = configuredKey;
+        return true;
     }
-    return maxId + 1;
+    sessionKey.resize(32);
+    return RAND_bytes((unsigned char *)&sessionKey[0], sessionKey.size()) == 1;
 }
 
-// Function to retrieve IP address of client_socket
-std::string getClientIP(int client_socket)
+// Function to compute the hex encoded HMAC-SHA256 of a token payload
+std::string signPayload(const std::string &payload)
 {
-    struct sockaddr_in addr;
-    socklen_t addr_len = sizeof(addr);
-    if (getpeername(client_socket, (struct sockaddr *)&addr, &addr_len) == 0)
+    unsigned char mac[EVP_MAX_MD_SIZE];
+    unsigned int macLen = 0;
+    HMAC(EVP_sha256(), sessionKey.data(), sessionKey.size(),
+         (const unsigned char *)payload.data(), payload.size(), mac, &macLen);
+
+    static const char hexDigits[] = "0123456789abcdef";
+    std::string hex;
+    for (unsigned int i = 0; i < macLen; i++)
     {
-        return inet_ntoa(addr.sin_addr); // Return client IP
+        hex += hexDigits[mac[i] >> 4];
+        hex += hexDigits[mac[i] & 0x0f];
     }
-    return "unknown";
+    return hex;
+}
+
+// Function to issue a session token "<uid>.<expiry>.<hmac>" for a logged in user
+std::string issueSessionToken(const std::string &uid)
+{
+    long long expiry = std::chrono::duration_cast<std::chrono::seconds>(
+                           std::chrono::system_clock::now().time_since_epoch())
+                           .count() +
+                       SESSION_TOKEN_TTL;
+    std::string payload = uid + "." + std::to_string(expiry);
+    return payload + "." + signPayload(payload);
+}
+
+// Function to validate a session token locally, sets uid on success
+bool validateSessionToken(const std::string &token, std::string &uid)
+{
+    std::string user = getTokenUser(token);
+    if (user.empty())
+        return false;
+
+    size_t lastDot = token.rfind('.');
+    std::string payload = token.substr(0, lastDot);
+    std::string expiry = token.substr(user.size() + 1, lastDot - user.size() - 1);
+    std::string mac = token.substr(lastDot + 1);
+    std::string expected = signPayload(payload);
+    if (mac.size() != expected.size() || CRYPTO_memcmp(mac.data(), expected.data(), mac.size()) != 0)
+        return false;
+
+    long long now = std::chrono::duration_cast<std::chrono::seconds>(
+                        std::chrono::system_clock::now().time_since_epoch())
+                        .count();
+    if (expiry.empty() || expiry.find_first_not_of("0123456789") != std::string::npos || std::stoll(expiry) < now)
+        return false;
+
+    uid = user;
+    return true;
+}
+
+// Function to check if a peer may announce the address of the client it relays for (FROM),
+// TWMAILER_TRUSTED_PROXY lists the addresses of the proxies, separated by commas
+bool isTrustedProxy(const std::string &peerIP)
+{
+    const char *trusted = getenv("TWMAILER_TRUSTED_PROXY");
+    if (trusted == NULL)
+        return false;
+    return ("," + std::string(trusted) + ",").find("," + peerIP + ",") != std::string::npos;
+}
+
+// Function to compute the salted SHA-256 hash of a password
+std::string hashPassword(const std::string &salt, const std::string &password)
+{
+    std::string input = salt + password;
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLen = 0;
+    EVP_Digest(input.data(), input.size(), digest, &digestLen, EVP_sha256(), NULL);
+    return std::string((char *)digest, digestLen);
+}
+
+// Function to clear the credential cache, e.g. after password changes (triggered by SIGHUP)
+void invalidateCredentialCache()
+{
+    credentialCacheMutex.lock();
+    credentialCache.clear();
+    credentialCacheMutex.unlock();
+    std::cout << "Credential cache flushed (" << credentialCacheHits << " hits, " << credentialCacheMisses << " misses)\n";
+}
+
+// Signal handler for SIGHUP, the accept loop flushes the cache right away
+void requestCredentialCacheFlush(int)
+{
+    credentialCacheFlushRequested = true;
+    wakeAcceptLoop();
 }
 
-// check if ip + username is blacklisted
-bool isBlacklisted(const std::string &key)
+// Function to print the credential cache counters without touching the cache (triggered by SIGUSR1)
+void printCredentialCacheStats()
 {
-    loginMutex.lock();
-    auto it = loginFailCount.find(key);
-    if (it != loginFailCount.end())
+    credentialCacheMutex.lock();
+    size_t entries = credentialCache.size();
+    credentialCacheMutex.unlock();
+    unsigned long hits = credentialCacheHits, misses = credentialCacheMisses;
+    std::cout << "Credential cache: " << entries << " entries, " << hits << " hits, " << misses << " misses";
+    if (hits + misses > 0)
     {
-        auto now = std::chrono::steady_clock::now();
+        std::cout << " (" << 100.0 * hits / (hits + misses) << "% hit rate)";
+    }
+    std::cout << std::endl;
+}
+
+// Signal handler for SIGUSR1, the accept loop prints the counters
+void requestCredentialCacheStats(int)
+{
+    credentialCacheStatsRequested = true;
+    wakeAcceptLoop();
+}
 
-        // Check if more than 3 fails and the blacklist time has not expired
-        if (it->second >= 3 && now - lastLoginAttempt[key] <= std::chrono::minutes(1))
+// Function to look up a login in the credential cache
+// Returns 1 for a cached success (uid is set), -1 for a cached failure and 0 if LDAP has to be asked
+int lookupCredentialCache(const std::string &username, const std::string &password, std::string &uid)
+{
+    int result = 0;
+    auto now = std::chrono::steady_clock::now();
+    credentialCacheMutex.lock();
+    auto it = credentialCache.find(username);
+    if (it != credentialCache.end())
+    {
+        std::string hash = hashPassword(it->second.salt, password);
+        if (now < it->second.validUntil && hash == it->second.validHash)
         {
-            loginMutex.unlock();
-            return true;
+            uid = it->second.uid;
+            result = 1;
         }
+        else if (now < it->second.invalidUntil && hash == it->second.invalidHash)
+        {
+            result = -1;
+        }
+    }
+    credentialCacheMutex.unlock();
 
-        // erase if 1 minute has expired
-        if (now - lastLoginAttempt[key] > std::chrono::minutes(1))
+    if (result == 0)
+        credentialCacheMisses++;
+    else
+        credentialCacheHits++;
+    return result;
+}
+
+// Function to store an LDAP verification result, an empty uid records a rejected password
+void storeCredentialCache(const std::string &username, const std::string &password, const std::string &uid)
+{
+    auto now = std::chrono::steady_clock::now();
+    credentialCacheMutex.lock();
+    if (credentialCache.find(username) == credentialCache.end() && credentialCache.size() >= CREDENTIAL_CACHE_SIZE)
+    {
+        // make room: drop expired entries first, any entry if that is not enough
+        for (auto it = credentialCache.begin(); it != credentialCache.end();)
         {
-            loginFailCount.erase(it);
+            if (now >= it->second.validUntil && now >= it->second.invalidUntil)
+                it = credentialCache.erase(it);
+            else
+                ++it;
         }
+        if (credentialCache.size() >= CREDENTIAL_CACHE_SIZE)
+        {
+            credentialCache.erase(credentialCache.begin());
+        }
+    }
+
+    CredentialCacheEntry &entry = credentialCache[username];
+    if (entry.salt.empty())
+    {
+        entry.salt.resize(16);
+        RAND_bytes((unsigned char *)&entry.salt[0], entry.salt.size());
+    }
+    if (uid != "")
+    {
+        entry.validHash = hashPassword(entry.salt, password);
+        entry.uid = uid;
+        entry.validUntil = now + CREDENTIAL_CACHE_TTL;
     }
+    else
+    {
+        entry.invalidHash = hashPassword(entry.salt, password);
+        entry.invalidUntil = now + CREDENTIAL_CACHE_NEGATIVE_TTL;
+    }
+    credentialCacheMutex.unlock();
+}
 
-    loginMutex.unlock();
-    return false;
+// Function to check if the LDAP URI points at this host (ldapi:// socket or loopback address)
+bool isLocalLdapUri(const std::string &uri)
+{
+    if (uri.rfind("ldapi://", 0) == 0)
+        return true;
+    if (uri.rfind("ldap://", 0) != 0)
+        return false;
+    std::string host = uri.substr(7, uri.find_first_of(":/", 7) - 7);
+    return host == "localhost" || host == "127.0.0.1";
 }
 
 // Function to handle the LOGIN command
-void handleLogin(int client_socket, const std::string &ldap_username, const std::string &password, std::string &sessionUsername)
+// (user_ip is the peer address, or the one a trusted proxy announced with FROM)
+void handleLogin(int client_socket, const std::string &user_ip, const std::string &ldap_username, const std::string &password, std::string &sessionUsername)
 {
-    const char *ldapUri = "ldap://ldap.technikum-wien.at:389";
+    // TWMAILER_LDAP_URI allows pointing the server at a local (stub) directory
+    const char *ldapUri = getenv("TWMAILER_LDAP_URI") ? getenv("TWMAILER_LDAP_URI") : "ldap://ldap.technikum-wien.at:389";
     const int ldapVersion = LDAP_VERSION3;
 
     // username
@@ -100,13 +317,35 @@ void handleLogin(int client_socket, const std::string &ldap_username, const std:
     strcpy(rawLdapUser, ldap_username.c_str());
     sprintf(ldapBindUser, "uid=%s,ou=people,dc=technikum-wien,dc=at", rawLdapUser);
 
-    std::string user_ip = getClientIP(client_socket);
     std::string ip_user_key = user_ip + "_" + ldap_username;
 
     if (isBlacklisted(ip_user_key))
     {
         std::cerr << "user ip are blacklisted\n";
-        send(client_socket, "ERR\nblacklisted\n", 16, 0);
+        send(client_socket, "ERR blacklisted\n", 16, 0);
+        return;
+    }
+
+    // answer repeated logins from the credential cache
+    std::string cachedUid;
+    int cached = lookupCredentialCache(ldap_username, password, cachedUid);
+    if (cached > 0)
+    {
+        clearLoginFailures(ip_user_key);
+        sessionUsername = cachedUid;
+        std::string response = "OK\n" + issueSessionToken(sessionUsername) + "\n";
+        send(client_socket, response.c_str(), response.size(), 0);
+        return;
+    }
+    if (cached < 0)
+    {
+        if (registerLoginFailure(ip_user_key))
+        {
+            std::cerr << "user ip added to blacklisted\n";
+            send(client_socket, "ERR ip and user blacklisted for 1 minute\n", 41, 0);
+            return;
+        }
+        send(client_socket, "ERR\n", 4, 0);
         return;
     }
 
@@ -147,11 +386,8 @@ void handleLogin(int client_socket, const std::string &ldap_username, const std:
         return;
     }
 
-    // start connection secure (initialize TLS)
-    rc = ldap_start_tls_s(
-        ldapHandle,
-        NULL,
-        NULL);
+    // start connection secure (initialize TLS), a local directory (e.g. a throwaway slapd) is used without
+    rc = isLocalLdapUri(ldapUri) ? LDAP_SUCCESS : ldap_start_tls_s(ldapHandle, NULL, NULL);
     if (rc != LDAP_SUCCESS)
     {
         std::cerr << "ldap_start_tls_s(): " << ldap_err2string(rc) << "\n";
@@ -179,31 +415,21 @@ void handleLogin(int client_socket, const std::string &ldap_username, const std:
 
         if (rc == LDAP_INVALID_CREDENTIALS)
         {
-            loginMutex.lock();
-            (loginFailCount[ip_user_key])++;
-            lastLoginAttempt[ip_user_key] = std::chrono::steady_clock::now();
-
-            if (loginFailCount[ip_user_key] >= 3)
+            storeCredentialCache(ldap_username, password, "");
+            if (registerLoginFailure(ip_user_key))
             {
                 std::cerr << "user ip added to blacklisted\n";
-                send(client_socket, "ERR\nip and user blacklisted for 1 minute", 40, 0);
-                loginMutex.unlock();
+                ldap_unbind_ext_s(ldapHandle, NULL, NULL);
+                send(client_socket, "ERR ip and user blacklisted for 1 minute\n", 41, 0);
                 return;
             }
-            loginMutex.unlock();
         }
         ldap_unbind_ext_s(ldapHandle, NULL, NULL);
         send(client_socket, "ERR\n", 4, 0);
         return;
     }
 
-    loginMutex.lock();
-    auto it = loginFailCount.find(ip_user_key);
-    if (it != loginFailCount.end())
-    {
-        loginFailCount.erase(it); // Remove entry after successful log in
-    }
-    loginMutex.unlock();
+    clearLoginFailures(ip_user_key);
 
     // perform ldap search
     LDAPMessage *searchResult;
@@ -283,26 +509,42 @@ void handleLogin(int client_socket, const std::string &ldap_username, const std:
     ldap_msgfree(searchResult);
     ldap_unbind_ext_s(ldapHandle, NULL, NULL);
 
-    send(client_socket, "OK\n", 3, 0);
+    storeCredentialCache(ldap_username, password, sessionUsername);
+
+    // hand out a token so the client can RESUME later without LDAP
+    std::string response = "OK\n" + issueSessionToken(sessionUsername) + "\n";
+    send(client_socket, response.c_str(), response.size(), 0);
+}
+
+// Function to handle the RESUME command, restores a session from a token without contacting LDAP
+// A valid token may also switch an existing session (used by the proxy on pooled connections).
+// The reply repeats the token, the expiry set at LOGIN is never extended, a session that
+// should outlive SESSION_TOKEN_TTL has to LOGIN again.
+// A rejected token ends the current session, requests pipelined after it must not run as the previous user.
+void handleResume(int client_socket, const std::string &token, std::string &sessionUsername)
+{
+    std::string uid;
+    if (!validateSessionToken(token, uid))
+    {
+        sessionUsername = "";
+        send(client_socket, "ERR\n", 4, 0);
+        return;
+    }
+    sessionUsername = uid;
+    std::string response = "OK\n" + token + "\n";
+    send(client_socket, response.c_str(), response.size(), 0);
 }
 
 // Function to handle the SEND command
 void handleSend(int client_socket, const std::string &sender, const std::string &receiver, const std::string &subject, const std::string &message, const std::string &mailDir)
 {
     std::string userDir = mailDir + "/" + receiver;
+    // compress before taking the lock
+    std::string content = encodeMessage(sender, subject, message, compressionThreshold);
     mailDirMutex.lock();
-    std::filesystem::create_directories(userDir);
-    int messageId = getNextMessageId(userDir);
-    std::string messageFile = userDir + "/" + std::to_string(messageId) + ".msg";
-    std::ofstream outFile(messageFile);
-
-    if (outFile)
-    {
-        outFile << "Sender: " << sender << "\n";
-        outFile << "Subject: " << subject << "\n";
-        outFile << "Message:\n"
-                << message;
-        outFile.close();
+    if (storeMessage(userDir, content) > 0)
+    {
+        bumpGeneration(userDir);
         send(client_socket, "OK\n", 3, 0);
     }
     else
@@ -313,53 +555,37 @@ void handleSend(int client_socket, const std::string &sender, const std::string
 }
 
 // Function to handle the LIST command
-void handleList(int client_socket, const std::string &user, const std::string &mailDir)
+// LIST                   -> all messages
+// LIST <since-id>        -> only messages with an id greater than since-id
+// LIST <offset> <limit>  -> one page of messages in id order
+// The arguments are given on the command line, e.g. "LIST 0 20".
+// The header line is "<count>: <generation>", every following line "<id>: <subject>".
+void handleList(int client_socket, const std::string &user, const std::string &mailDir, const std::string &param1, const std::string &param2)
 {
     std::string userDir = mailDir + "/" + user;
+    std::string lines;
+    int count = 0;
     mailDirMutex.lock();
-    bool dirExists = std::filesystem::exists(userDir);
+    bool valid = listMessages(userDir, param1, param2, lines, count);
+    uint64_t generation = getGeneration(userDir);
     mailDirMutex.unlock();
-    if (!dirExists)
+
+    if (!valid || (count == 0 && param1 == ""))
     {
         send(client_socket, "ERR\n", 4, 0);
         return;
     }
+    sendAll(client_socket, std::to_string(count) + ": " + std::to_string(generation) + "\n" + lines);
+}
 
-    std::string response;
-    int count = 0;
+// Function to handle the STAT command, lets clients skip LIST if the generation is unchanged
+void handleStat(int client_socket, const std::string &user, const std::string &mailDir)
+{
     mailDirMutex.lock();
-    for (const auto &entry : std::filesystem::directory_iterator(userDir))
-    {
-        if (entry.path().extension() == ".msg")
-        {
-            count++;
-            std::ifstream inFile(entry.path());
-            std::string line, subject;
-
-            // Search for subject
-            while (std::getline(inFile, line))
-            {
-                if (line.rfind("Subject: ", 0) == 0) // Line that begins with subject
-                {
-                    subject = line.substr(9); // extract subject
-                    break;
-                }
-            }
-
-            inFile.close();
-            response += std::to_string(count) + ": " + subject + "\n";
-        }
-    }
+    uint64_t generation = getGeneration(mailDir + "/" + user);
     mailDirMutex.unlock();
-    response = std::to_string(count) + ": " + "\n" + response;
-    if (count == 0)
-    {
-        send(client_socket, "ERR\n", 4, 0);
-    }
-    else
-    {
-        send(client_socket, response.c_str(), response.size(), 0);
-    }
+    std::string response = "OK\n" + std::to_string(generation) + "\n";
+    send(client_socket, response.c_str(), response.size(), 0);
 }
 
 // Function to handle the READ command
@@ -368,23 +594,27 @@ void handleRead(int client_socket, const std::string &username, const std::strin
     mailDirMutex.lock();
     std::string userDir = mailDir + "/" + username;
     std::string messageFile = userDir + "/" + message_number + ".msg";
-    std::ifstream inFile(messageFile);
+    std::string content, response;
+    bool found = readMessageFile(messageFile, content);
+    mailDirMutex.unlock();
 
-    if (inFile)
+    if (found && decodeMessage(content, response))
     {
-        std::string line, response;
-        while (std::getline(inFile, line))
+        if (response.empty() || response.back() != '\n')
         {
-            response += line + "\n";
+            response += "\n";
         }
-        inFile.close();
-        send(client_socket, response.c_str(), response.size(), 0);
+        // the reply always ends with a "." line so clients can tell where it stops
+        if (response != ".\n" && (response.size() < 3 || response.compare(response.size() - 3, 3, "\n.\n") != 0))
+        {
+            response += ".\n";
+        }
+        sendAll(client_socket, response);
     }
     else
     {
         send(client_socket, "ERR\n", 4, 0);
     }
-    mailDirMutex.unlock();
 }
 
 // Function to handle the DEL command
@@ -395,6 +625,7 @@ void handleDel(int client_socket, const std::string &username, const std::string
     mailDirMutex.lock();
     if (std::filesystem::remove(messageFile))
     {
+        bumpGeneration(userDir);
         send(client_socket, "OK\n", 3, 0);
     }
     else
@@ -404,43 +635,148 @@ void handleDel(int client_socket, const std::string &username, const std::string
     mailDirMutex.unlock();
 }
 
+// Function to handle the MREAD command
+// Response: "OK\n<count>\n" followed by "<id> <length>\n<message>" for every existing id in the ranges,
+// compressed messages are passed on as stored if the client announced "CAPA deflate".
+// The messages are streamed one at a time without holding mailDirMutex while sending, a message deleted
+// after the ids were selected is sent with length 0.
+void handleMultiRead(int client_socket, const std::string &username, const std::string &idSpec, const std::string &mailDir, bool acceptsDeflate)
+{
+    std::vector<std::pair<int, int>> ranges;
+    if (!parseIdRanges(idSpec, ranges))
+    {
+        send(client_socket, "ERR\n", 4, 0);
+        return;
+    }
+
+    std::string userDir = mailDir + "/" + username;
+    mailDirMutex.lock();
+    std::vector<int> ids = selectMessageIds(userDir, ranges);
+    mailDirMutex.unlock();
+
+    if (ids.empty())
+    {
+        send(client_socket, "ERR\n", 4, 0);
+        return;
+    }
+    if (!sendAll(client_socket, "OK\n" + std::to_string(ids.size()) + "\n"))
+        return;
+    for (int id : ids)
+    {
+        std::string message;
+        mailDirMutex.lock();
+        bool found = readMessageFile(userDir + "/" + std::to_string(id) + ".msg", message);
+        mailDirMutex.unlock();
+        if (!found || (!acceptsDeflate && !decodeMessage(message, message)))
+        {
+            message.clear();
+        }
+        if (!sendAll(client_socket, std::to_string(id) + " " + std::to_string(message.size()) + "\n" + message))
+            return;
+    }
+}
+
+// Function to handle the MDEL command
+// Response: "OK\n<count>\n" with the number of removed messages
+void handleMultiDel(int client_socket, const std::string &username, const std::string &idSpec, const std::string &mailDir)
+{
+    std::vector<std::pair<int, int>> ranges;
+    if (!parseIdRanges(idSpec, ranges))
+    {
+        send(client_socket, "ERR\n", 4, 0);
+        return;
+    }
+
+    std::string userDir = mailDir + "/" + username;
+    int count = 0;
+    mailDirMutex.lock();
+    for (int id : selectMessageIds(userDir, ranges))
+    {
+        std::error_code ec;
+        if (std::filesystem::remove(userDir + "/" + std::to_string(id) + ".msg", ec))
+        {
+            count++;
+        }
+    }
+    if (count > 0)
+    {
+        bumpGeneration(userDir);
+    }
+    mailDirMutex.unlock();
+
+    if (count == 0)
+    {
+        send(client_socket, "ERR\n", 4, 0);
+        return;
+    }
+    std::string response = "OK\n" + std::to_string(count) + "\n";
+    send(client_socket, response.c_str(), response.size(), 0);
+}
+
 // Function for the client communication where the server handles the commands
 void clientCommunication(int client_socket, const std::string &mailDir)
 {
     send(client_socket, "Welcome to the server!\n", 23, 0);
 
-    char buffer[BUF];
+    RequestReader reader;
+    reader.socket = client_socket;
 
     std::string sessionUsername = "";
+    std::string clientIP = getClientIP(client_socket); // key of the login rate limiting
+    bool acceptsDeflate = false; // client can decode compressed messages itself
 
     // Loop to handle the client requests
-    while (true)
+    // (while draining, idle sessions are closed, half received requests are still finished)
+    std::string text;
+    while (readRequest(reader, text, sessionUsername == "" ? MAX_LOGIN_REQUEST_SIZE : MAX_REQUEST_SIZE, waitForClient))
     {
-        int size = recv(client_socket, buffer, BUF, 0);
-        if (size <= 0)
-            break;
-        buffer[size] = '\0';
-        std::istringstream request(buffer);
-
-        std::string command, param1, param2, message;
-        request >> command >> param1 >> std::ws;
-        std::getline(request, param2);
-        std::getline(request, message, '\0');
+        Request request = parseRequest(text);
+        const std::string &command = request.command;
+        const std::string &param1 = request.param1;
+        const std::string &param2 = request.param2;
+        const std::string &message = request.message;
 
         if (command == "LOGIN")
         {
             if (sessionUsername != "")
             {
-                send(client_socket, "ERR\nAlready logged in\n", 21, 0);
+                send(client_socket, "ERR Already logged in\n", 22, 0);
+                continue;
+            }
+            handleLogin(client_socket, clientIP, param1, param2, sessionUsername);
+        }
+        else if (command == "FROM")
+        {
+            // param1 = address of the client a proxy relays the following LOGIN for
+            if (sessionUsername != "" || !isTrustedProxy(getClientIP(client_socket)))
+            {
+                send(client_socket, "ERR\n", 4, 0);
                 continue;
             }
-            handleLogin(client_socket, param1, param2, sessionUsername);
+            clientIP = param1;
+            send(client_socket, "OK\n", 3, 0);
+        }
+        else if (command == "RESUME")
+        {
+            // param1 = session token from a previous LOGIN
+            handleResume(client_socket, param1, sessionUsername);
+        }
+        else if (command == "CAPA")
+        {
+            // param1 = capability the client supports
+            if (param1 != "deflate")
+            {
+                send(client_socket, "ERR\n", 4, 0);
+                continue;
+            }
+            acceptsDeflate = true;
+            send(client_socket, "OK\n", 3, 0);
         }
         else if (command == "SEND")
         {
             if (sessionUsername == "")
             {
-                send(client_socket, "ERR\nLogin first\n", 17, 0);
+                send(client_socket, "ERR Login first\n", 16, 0);
                 continue;
             }
             // param1 = receiver
@@ -451,16 +787,27 @@ void clientCommunication(int client_socket, const std::string &mailDir)
         {
             if (sessionUsername == "")
             {
-                send(client_socket, "ERR\nLogin first\n", 17, 0);
+                send(client_socket, "ERR Login first\n", 16, 0);
                 continue;
             }
-            handleList(client_socket, sessionUsername, mailDir);
+            // param1 = since-id or offset (optional)
+            // param2 = limit (optional)
+            handleList(client_socket, sessionUsername, mailDir, param1, param2);
+        }
+        else if (command == "STAT")
+        {
+            if (sessionUsername == "")
+            {
+                send(client_socket, "ERR Login first\n", 16, 0);
+                continue;
+            }
+            handleStat(client_socket, sessionUsername, mailDir);
         }
         else if (command == "READ")
         {
             if (sessionUsername == "")
             {
-                send(client_socket, "ERR\nLogin first\n", 17, 0);
+                send(client_socket, "ERR Login first\n", 16, 0);
                 continue;
             }
             // param1 = message_number
@@ -470,24 +817,54 @@ void clientCommunication(int client_socket, const std::string &mailDir)
         {
             if (sessionUsername == "")
             {
-                send(client_socket, "ERR\nLogin first\n", 17, 0);
+                send(client_socket, "ERR Login first\n", 16, 0);
                 continue;
             }
             // param1 = message_number
             handleDel(client_socket, sessionUsername, param1, mailDir);
         }
+        else if (command == "MREAD")
+        {
+            if (sessionUsername == "")
+            {
+                send(client_socket, "ERR Login first\n", 16, 0);
+                continue;
+            }
+            // param1 = message ids, e.g. 1,3,7-12
+            handleMultiRead(client_socket, sessionUsername, param1, mailDir, acceptsDeflate);
+        }
+        else if (command == "MDEL")
+        {
+            if (sessionUsername == "")
+            {
+                send(client_socket, "ERR Login first\n", 16, 0);
+                continue;
+            }
+            // param1 = message ids, e.g. 1,3,7-12
+            handleMultiDel(client_socket, sessionUsername, param1, mailDir);
+        }
         else if (command == "QUIT")
         {
             break;
         }
+        else if (command != "")
+        {
+            // every request gets a reply, otherwise pipelined clients lose track
+            send(client_socket, "ERR\n", 4, 0);
+        }
+    }
+    if (draining)
+    {
+        sayGoodbye(client_socket);
     }
     close(client_socket);
+    activeSessions--;
 }
 
 // Main function where the server initializes and waits for client connections
 int main(int argc, char **argv)
 {
-    if (argc != 3)
+    if (argc != 3 && argc != 4)
     {
         showUsage(argv[0]);
         return EXIT_FAILURE;
@@ -496,32 +873,138 @@ int main(int argc, char **argv)
     int port = std::stoi(argv[1]);
     std::string ldap_username = "";
     std::string mailDir = "src/" + std::string(argv[2]);
+    bool proxyMode = std::string(argv[2]) == "--proxy";
+
+    if (proxyMode != (argc == 4))
+    {
+        showUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    // a client that resets its connection mid-reply must only end its own session, not the process
+    signal(SIGPIPE, SIG_IGN);
+
+    if (proxyMode)
+    {
+        if (!loadBackends(argv[3]))
+        {
+            std::cerr << "Error loading backends from " << argv[3] << "\n";
+            return EXIT_FAILURE;
+        }
+        signal(SIGHUP, requestBackendReload);
+    }
+    else
+    {
+        if (!initSessionKey())
+        {
+            std::cerr << "Error initializing session key\n";
+            return EXIT_FAILURE;
+        }
+        signal(SIGHUP, requestCredentialCacheFlush);
+        signal(SIGUSR1, requestCredentialCacheStats);
+    }
 
-    sockaddr_in server_addr = {};
-    server_addr.sin_family = AF_INET;         // IPv4
-    server_addr.sin_port = htons(port);       // Port (im Netzwerk-Byte-Order)
-    server_addr.sin_addr.s_addr = INADDR_ANY; // Akzeptiere Verbindungen von jeder Adresse
+    const char *threshold = getenv("TWMAILER_COMPRESSION_THRESHOLD");
+    if (threshold != NULL)
+    {
+        if (!isNumber(threshold))
+        {
+            std::cerr << "Invalid TWMAILER_COMPRESSION_THRESHOLD \"" << threshold << "\", expected a number of bytes\n";
+            showUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        compressionThreshold = std::strtoul(threshold, NULL, 10);
+    }
 
-    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket < 0 || bind(server_socket, (sockaddr *)&server_addr, sizeof(server_addr)) < 0 || listen(server_socket, 5) < 0)
+    int drainFd = initDrain();
+    if (drainFd < 0)
     {
         perror("Error initializing server");
         return EXIT_FAILURE;
     }
 
-    while (true)
+    // hot restart: take over the listening socket of a server that is still running
+    const char *handoffPath = getenv("TWMAILER_HANDOFF_SOCKET");
+    int server_socket = handoffPath ? receiveListeningSocket(handoffPath) : -1;
+    if (server_socket >= 0)
+    {
+        std::cout << "Took over the listening socket of the running server" << std::endl;
+    }
+    else
     {
+        sockaddr_in server_addr = {};
+        server_addr.sin_family = AF_INET;         // IPv4
+        server_addr.sin_port = htons(port);       // Port (im Netzwerk-Byte-Order)
+        server_addr.sin_addr.s_addr = INADDR_ANY; // Akzeptiere Verbindungen von jeder Adresse
+
+        int reuse = 1;
+        server_socket = socket(AF_INET, SOCK_STREAM, 0);
+        if (server_socket < 0 || setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+            bind(server_socket, (sockaddr *)&server_addr, sizeof(server_addr)) < 0 || listen(server_socket, SOMAXCONN) < 0)
+        {
+            perror("Error initializing server");
+            return EXIT_FAILURE;
+        }
+    }
+    // both processes poll the socket during a handoff, accept must not block on a lost race
+    fcntl(server_socket, F_SETFL, fcntl(server_socket, F_GETFL) | O_NONBLOCK);
+
+    if (handoffPath && !startHandoffListener(handoffPath, server_socket))
+    {
+        std::cerr << "Error creating handoff socket " << handoffPath << "\n";
+    }
+
+    while (!draining)
+    {
+        pollfd fds[2] = {{server_socket, POLLIN, 0}, {drainFd, POLLIN, 0}};
+        if (poll(fds, 2, -1) <= 0)
+            continue;
+        if (fds[1].revents & POLLIN)
+        {
+            // woken by a signal handler: SIGTERM ends the loop, SIGHUP flushes the credential cache,
+            // SIGUSR1 prints its counters
+            char wake[16];
+            if (read(drainFd, wake, sizeof(wake)) < 0)
+                continue;
+            if (credentialCacheStatsRequested.exchange(false))
+            {
+                printCredentialCacheStats();
+            }
+            if (credentialCacheFlushRequested.exchange(false))
+            {
+                invalidateCredentialCache();
+            }
+            continue;
+        }
+
         sockaddr_in client_addr;
         socklen_t client_len = sizeof(client_addr);
         int client_socket = accept(server_socket, (sockaddr *)&client_addr, &client_len);
         if (client_socket >= 0)
         {
-            std::thread newThread(clientCommunication, client_socket, mailDir);
-            newThread.detach();
-            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            // replies are written one by one, Nagle would hold every small reply of a pipelined batch back
+            // until the client's delayed ACK (about 40 ms per batch)
+            int noDelay = 1;
+            setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+            activeSessions++;
+            if (proxyMode)
+            {
+                std::thread newThread(proxyCommunication, client_socket);
+                newThread.detach();
+            }
+            else
+            {
+                std::thread newThread(clientCommunication, client_socket, mailDir);
+                newThread.detach();
+            }
         }
     }
 
+    // stop accepting (a successor keeps its own copy of the socket) and let the sessions finish
     close(server_socket);
+    auto drainStart = std::chrono::steady_clock::now();
+    bool drained = waitForSessions();
+    std::cout << (drained ? "Drained" : "Drain timed out") << " after "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - drainStart).count()
+              << " ms\n";
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
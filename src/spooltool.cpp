@@ -0,0 +1,863 @@
+// spooltool: offline bulk import/export between the mail-spool layout (<user>/<id>.msg) and mbox/Maildir,
+// and moving mailboxes between the spools of a proxy's backends after the backend list changed
+//
+// The work runs as a pipeline of four stages connected by bounded queues:
+//   scan (1 thread) -> parse (N) -> transform (N) -> write (N)
+// On import the ids are reserved before the parallel stages (per Maildir on scan, per mbox on parse),
+// so every mailbox keeps the order of its source no matter which thread writes a message.
+// The server must not write to the spool while spooltool imports into it.
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <ctime>
+#include <cstdio>
+#include <sys/stat.h>
+#include "message.h"
+#include "mailbox.h"
+#include "ring.h"
+
+#define QUEUE_CAPACITY 256 // items buffered between two stages
+#define WRITE_BATCH 64     // messages a writer takes from its queue at once
+
+namespace fs = std::filesystem;
+
+// Queue between two stages, push blocks while it is full; pop fails once it is empty
+// and all producers are done
+template <typename T>
+class BoundedQueue
+{
+public:
+    BoundedQueue(size_t capacity, int producers) : capacity(capacity), producers(producers) {}
+
+    void push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&]()
+                     { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    // waits for the first item, then takes whatever else is available up to max
+    bool popBatch(std::vector<T> &batch, size_t max)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&]()
+                      { return !items.empty() || producers == 0; });
+        while (!items.empty() && batch.size() < max)
+        {
+            batch.push_back(std::move(items.front()));
+            items.pop_front();
+        }
+        notFull.notify_all();
+        return !batch.empty();
+    }
+
+    bool pop(T &item)
+    {
+        std::vector<T> batch;
+        if (!popBatch(batch, 1))
+            return false;
+        item = std::move(batch.front());
+        return true;
+    }
+
+    void producerDone()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        producers--;
+        notEmpty.notify_all();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable notFull, notEmpty;
+    std::deque<T> items;
+    size_t capacity;
+    int producers;
+};
+
+// Counters of one pipeline stage
+struct StageStats
+{
+    std::string name;
+    int threads = 1;
+    std::atomic<unsigned long> items{0};
+    std::atomic<unsigned long> bytes{0};
+    std::atomic<long long> busyNanos{0}; // time spent working, queue waits excluded
+    std::atomic<long long> doneNanos{0}; // when the last thread of the stage finished
+};
+
+// Unit of work: a source file in the scan/parse stages, one message afterwards
+struct MailItem
+{
+    std::string user;
+    fs::path path;
+    int id = 0;
+    bool mbox = false;
+    std::string sender, subject, body;
+    time_t date = 0;
+    int seq = 0;          // export: position in the user's mailbox
+    std::string name;     // export: Maildir file name
+    std::string content; // the bytes the write stage stores
+};
+
+using Clock = std::chrono::steady_clock;
+static Clock::time_point pipelineStart;
+
+// Function to account the work time of one item
+static void addBusy(StageStats &stats, Clock::time_point start)
+{
+    stats.busyNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+// Function to start a stage with the given number of threads all running work
+static void runStage(std::vector<std::thread> &threads, StageStats &stats, int count, std::function<void()> work)
+{
+    stats.threads = count;
+    auto remaining = std::make_shared<std::atomic<int>>(count);
+    for (int i = 0; i < count; i++)
+    {
+        threads.emplace_back([&stats, work, remaining]()
+                             {
+            work();
+            if (--(*remaining) == 0)
+            {
+                stats.doneNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - pipelineStart).count();
+            } });
+    }
+}
+
+// Function to print the throughput of every stage
+static void printStats(const std::vector<StageStats *> &stages)
+{
+    std::cout << std::left << std::setw(11) << "stage" << std::setw(9) << "threads" << std::setw(10) << "items"
+              << std::setw(12) << "items/s" << std::setw(10) << "MB/s" << "busy\n";
+    for (const StageStats *stats : stages)
+    {
+        double wall = stats->doneNanos / 1e9;
+        double busy = stats->busyNanos / 1e9;
+        std::cout << std::left << std::setw(11) << stats->name << std::setw(9) << stats->threads
+                  << std::setw(10) << stats->items << std::fixed << std::setprecision(1)
+                  << std::setw(12) << (wall > 0 ? stats->items / wall : 0)
+                  << std::setw(10) << (wall > 0 ? stats->bytes / wall / (1024 * 1024) : 0)
+                  << (wall > 0 ? 100 * busy / (wall * stats->threads) : 0) << "%\n";
+    }
+}
+
+// Function to read a whole file
+static bool readFile(const fs::path &path, std::string &content)
+{
+    std::ifstream inFile(path, std::ios::binary);
+    if (!inFile)
+        return false;
+    content.assign(std::istreambuf_iterator<char>(inFile), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Function to get the modification time of a file
+static time_t getModificationTime(const fs::path &path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? info.st_mtime : time(NULL);
+}
+
+// ---------------------------------------------------------------------------------------------
+// import: mbox files / Maildirs -> spool
+// ---------------------------------------------------------------------------------------------
+
+// Function to split an RFC 822 message into sender, subject and body
+static void parseRfc822(const std::string &raw, MailItem &item)
+{
+    std::istringstream rawStream(raw);
+    std::string line;
+    std::vector<std::string> headers;
+    while (std::getline(rawStream, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty())
+            break;
+        // folded header lines continue the previous header
+        if ((line[0] == ' ' || line[0] == '\t') && !headers.empty())
+            headers.back() += " " + line.substr(line.find_first_not_of(" \t"));
+        else
+            headers.push_back(line);
+    }
+    std::getline(rawStream, item.body, '\0');
+
+    for (const auto &field : headers)
+    {
+        if (field.compare(0, 5, "From:") == 0)
+            item.sender = field.substr(5);
+        else if (field.compare(0, 8, "Subject:") == 0)
+            item.subject = field.substr(8);
+    }
+}
+
+// Function to split an mbox file into its messages (mboxrd: ">From " lines are unescaped)
+static std::vector<std::string> splitMbox(const std::string &mbox)
+{
+    std::vector<std::string> messages;
+    std::istringstream mboxStream(mbox);
+    std::string line, current;
+    bool inMessage = false, previousBlank = true;
+    while (std::getline(mboxStream, line))
+    {
+        if (previousBlank && line.compare(0, 5, "From ") == 0)
+        {
+            if (inMessage)
+                messages.push_back(current);
+            current.clear();
+            inMessage = true;
+        }
+        else if (inMessage)
+        {
+            size_t quotes = line.find_first_not_of('>');
+            if (quotes != std::string::npos && quotes > 0 && line.compare(quotes, 5, "From ") == 0)
+                line.erase(0, 1);
+            current += line + "\n";
+        }
+        previousBlank = line.empty() || line == "\r";
+    }
+    if (inMessage)
+        messages.push_back(current);
+
+    // the blank line before the next From_ line is a separator, not part of the message
+    for (auto &message : messages)
+    {
+        if (message.size() >= 2 && message.compare(message.size() - 2, 2, "\n\n") == 0)
+            message.pop_back();
+    }
+    return messages;
+}
+
+// Function to map an address like "Jane Doe <jane@example.org>" to the spool's user name form ("jane")
+static std::string toUsername(const std::string &address)
+{
+    std::string mailbox = address;
+    size_t open = mailbox.find('<');
+    if (open != std::string::npos)
+        mailbox = mailbox.substr(open + 1, mailbox.find('>', open) - open - 1);
+    std::string user;
+    for (char c : mailbox.substr(0, mailbox.find('@')))
+    {
+        if (isalnum((unsigned char)c))
+            user += c;
+    }
+    return user.empty() ? "unknown" : user;
+}
+
+// Function to check for a body line made of dots only
+static bool isDotLine(const std::string &line)
+{
+    return !line.empty() && line.find_first_not_of('.') == std::string::npos;
+}
+
+// Function to escape a body line for the spool: a lone "." would end a READ reply early, so lines of
+// only dots get one more on import and lose it again on export ("." <-> "..", ".." <-> "...")
+static std::string stuffDots(const std::string &line)
+{
+    return isDotLine(line) ? "." + line : line;
+}
+
+// Function to undo stuffDots on every line of a stored body
+static std::string unstuffDots(const std::string &body)
+{
+    std::string result;
+    size_t pos = 0;
+    while (pos < body.size())
+    {
+        size_t lineEnd = body.find('\n', pos);
+        std::string line = body.substr(pos, lineEnd == std::string::npos ? std::string::npos : lineEnd - pos);
+        result += isDotLine(line) && line.size() > 1 ? line.substr(1) : line;
+        if (lineEnd == std::string::npos)
+            break;
+        result += "\n";
+        pos = lineEnd + 1;
+    }
+    return result;
+}
+
+// Per-user lock, the id reservations of one user happen one after the other
+static std::mutex spoolUsersMutex;
+static std::unordered_map<std::string, std::unique_ptr<std::mutex>> spoolUsers;
+
+// Function to reserve count consecutive ids in a user's mailbox, returns the first one (0 on error)
+static int allocateIds(const fs::path &spoolDir, const std::string &user, int count)
+{
+    spoolUsersMutex.lock();
+    auto &slot = spoolUsers[user];
+    if (!slot)
+        slot.reset(new std::mutex());
+    std::mutex &userMutex = *slot;
+    spoolUsersMutex.unlock();
+
+    std::lock_guard<std::mutex> lock(userMutex);
+    fs::path userDir = spoolDir / user;
+    fs::create_directories(userDir);
+    return allocateMessageIds(userDir, count);
+}
+
+static int runImport(const fs::path &sourceDir, const fs::path &spoolDir, int jobs, size_t compressionThreshold)
+{
+    StageStats scanStats, parseStats, transformStats, writeStats;
+    scanStats.name = "scan";
+    parseStats.name = "parse";
+    transformStats.name = "transform";
+    writeStats.name = "write";
+    BoundedQueue<MailItem> sources(QUEUE_CAPACITY, 1), parsed(QUEUE_CAPACITY, jobs),
+        transformed(QUEUE_CAPACITY, jobs);
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+    pipelineStart = Clock::now();
+
+    // scan: every regular file is a user's mbox, every directory a user's Maildir
+    runStage(threads, scanStats, 1, [&]()
+             {
+        for (const auto &entry : fs::directory_iterator(sourceDir))
+        {
+            auto start = Clock::now();
+            std::vector<MailItem> found;
+            if (entry.is_regular_file())
+            {
+                MailItem item;
+                item.user = entry.path().stem().string();
+                item.path = entry.path();
+                item.mbox = true;
+                found.push_back(item);
+            }
+            else if (entry.is_directory())
+            {
+                for (const char *sub : {"cur", "new"})
+                {
+                    if (!fs::is_directory(entry.path() / sub))
+                        continue;
+                    for (const auto &file : fs::directory_iterator(entry.path() / sub))
+                    {
+                        MailItem item;
+                        item.user = entry.path().filename().string();
+                        item.path = file.path();
+                        found.push_back(item);
+                    }
+                }
+                // Maildir names start with the delivery time, their order is the mailbox order
+                std::sort(found.begin(), found.end(), [](const MailItem &a, const MailItem &b)
+                          { return a.path.filename() < b.path.filename(); });
+                int id = found.empty() ? 1 : allocateIds(spoolDir, entry.path().filename().string(), found.size());
+                if (id == 0)
+                {
+                    std::cerr << "Cannot allocate ids for " << entry.path() << "\n";
+                    failures += found.size();
+                    found.clear();
+                }
+                for (auto &item : found)
+                    item.id = id++;
+            }
+            scanStats.items += found.size();
+            addBusy(scanStats, start);
+            for (auto &item : found)
+                sources.push(std::move(item));
+        }
+        sources.producerDone(); });
+
+    // parse: read the files and split them into messages
+    runStage(threads, parseStats, jobs, [&]()
+             {
+        MailItem source;
+        while (sources.pop(source))
+        {
+            auto start = Clock::now();
+            std::string raw;
+            if (!readFile(source.path, raw))
+            {
+                std::cerr << "Cannot read " << source.path << "\n";
+                failures++;
+                continue;
+            }
+            parseStats.bytes += raw.size();
+            std::vector<std::string> messages;
+            if (source.mbox)
+                messages = splitMbox(raw);
+            else
+                messages.push_back(raw);
+            // an mbox gets its ids in file order, a Maildir message brings the one reserved on scan
+            int id = source.mbox && !messages.empty() ? allocateIds(spoolDir, source.user, messages.size()) : source.id;
+            if (id == 0)
+            {
+                std::cerr << "Cannot allocate ids for " << source.path << "\n";
+                failures += messages.size();
+                continue;
+            }
+            std::vector<MailItem> items(messages.size());
+            for (size_t i = 0; i < messages.size(); i++)
+            {
+                items[i].user = source.user;
+                items[i].id = id + i;
+                parseRfc822(messages[i], items[i]);
+            }
+            parseStats.items += items.size();
+            addBusy(parseStats, start);
+            for (auto &item : items)
+                parsed.push(std::move(item));
+        }
+        parsed.producerDone(); });
+
+    // transform: normalize into the spool format (dot lines are stuffed, see stuffDots)
+    runStage(threads, transformStats, jobs, [&]()
+             {
+        MailItem item;
+        while (parsed.pop(item))
+        {
+            auto start = Clock::now();
+            size_t subjectStart = item.subject.find_first_not_of(' ');
+            std::string subject = subjectStart == std::string::npos ? "" : item.subject.substr(subjectStart);
+            std::istringstream bodyStream(item.body);
+            std::string line, body;
+            while (std::getline(bodyStream, line))
+            {
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                body += stuffDots(line) + "\n";
+            }
+            item.content = encodeMessage(toUsername(item.sender), subject, body + ".\n", compressionThreshold);
+            transformStats.items++;
+            transformStats.bytes += item.content.size();
+            addBusy(transformStats, start);
+            transformed.push(std::move(item));
+        }
+        transformed.producerDone(); });
+
+    // write: every message already has its id, the directories were created with the id reservation
+    runStage(threads, writeStats, jobs, [&]()
+             {
+        std::vector<MailItem> batch;
+        while (transformed.popBatch(batch, WRITE_BATCH))
+        {
+            auto start = Clock::now();
+            for (auto &item : batch)
+            {
+                std::ofstream outFile(spoolDir / item.user / (std::to_string(item.id) + ".msg"), std::ios::binary);
+                if (!(outFile << item.content))
+                    failures++;
+                writeStats.bytes += item.content.size();
+            }
+            writeStats.items += batch.size();
+            addBusy(writeStats, start);
+            batch.clear();
+        } });
+
+    for (auto &thread : threads)
+        thread.join();
+    printStats({&scanStats, &parseStats, &transformStats, &writeStats});
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// ---------------------------------------------------------------------------------------------
+// export: spool -> mbox files / Maildirs
+// ---------------------------------------------------------------------------------------------
+
+// Open mbox files of the export, appends to one file are serialized and kept in mailbox order:
+// messages that arrive before their predecessors wait in pending
+struct MboxFile
+{
+    std::mutex mutex;
+    std::ofstream stream;
+    int nextSeq = 0;
+    std::map<int, std::string> pending;
+};
+
+// Function to append the pending messages that are next in mailbox order
+static bool flushMbox(MboxFile &mbox)
+{
+    bool ok = true;
+    while (!mbox.pending.empty() && mbox.pending.begin()->first == mbox.nextSeq)
+    {
+        ok = (mbox.stream << mbox.pending.begin()->second) && ok;
+        mbox.pending.erase(mbox.pending.begin());
+        mbox.nextSeq++;
+    }
+    return ok;
+}
+
+static int runExport(const fs::path &spoolDir, const fs::path &targetDir, bool toMbox, int jobs)
+{
+    StageStats scanStats, parseStats, transformStats, writeStats;
+    scanStats.name = "scan";
+    parseStats.name = "parse";
+    transformStats.name = "transform";
+    writeStats.name = "write";
+    BoundedQueue<MailItem> sources(QUEUE_CAPACITY, 1), parsed(QUEUE_CAPACITY, jobs),
+        transformed(QUEUE_CAPACITY, jobs);
+    std::atomic<int> failures(0);
+    std::mutex outputsMutex;
+    std::unordered_map<std::string, std::unique_ptr<MboxFile>> mboxFiles;
+    std::unordered_map<std::string, bool> maildirsCreated;
+    std::vector<std::thread> threads;
+    pipelineStart = Clock::now();
+    fs::create_directories(targetDir);
+
+    // scan: every <user>/<id>.msg, in id order
+    runStage(threads, scanStats, 1, [&]()
+             {
+        for (const auto &userEntry : fs::directory_iterator(spoolDir))
+        {
+            if (!userEntry.is_directory())
+                continue;
+            auto start = Clock::now();
+            std::vector<MailItem> found;
+            for (const auto &entry : fs::directory_iterator(userEntry.path()))
+            {
+                if (entry.path().extension() != ".msg")
+                    continue;
+                MailItem item;
+                item.user = userEntry.path().filename().string();
+                item.path = entry.path();
+                item.id = std::atoi(entry.path().stem().c_str());
+                found.push_back(item);
+            }
+            std::sort(found.begin(), found.end(), [](const MailItem &a, const MailItem &b)
+                      { return a.id < b.id; });
+            // the importer orders a Maildir by file name, so the names must sort like the ids:
+            // the time never decreases along the mailbox and the id is zero padded
+            time_t nameTime = 0;
+            for (size_t i = 0; i < found.size(); i++)
+            {
+                MailItem &item = found[i];
+                item.seq = i;
+                item.date = getModificationTime(item.path);
+                nameTime = std::max(nameTime, item.date);
+                char name[64];
+                snprintf(name, sizeof(name), "%lld.%010d.twmailer:2,S", (long long)nameTime, item.id);
+                item.name = name;
+            }
+            scanStats.items += found.size();
+            addBusy(scanStats, start);
+            for (auto &item : found)
+                sources.push(std::move(item));
+        }
+        sources.producerDone(); });
+
+    // parse: read and decompress the stored messages
+    runStage(threads, parseStats, jobs, [&]()
+             {
+        MailItem item;
+        while (sources.pop(item))
+        {
+            auto start = Clock::now();
+            std::string stored, plain;
+            if (!readFile(item.path, stored) || !decodeMessage(stored, plain))
+            {
+                std::cerr << "Cannot read " << item.path << "\n";
+                failures++;
+                continue;
+            }
+            parseStats.bytes += stored.size();
+
+            size_t messagePos = plain.find("\nMessage:\n");
+            std::istringstream headerStream(plain.substr(0, messagePos));
+            std::string line;
+            while (std::getline(headerStream, line))
+            {
+                if (line.compare(0, 8, "Sender: ") == 0)
+                    item.sender = line.substr(8);
+                else if (line.compare(0, 9, "Subject: ") == 0)
+                    item.subject = line.substr(9);
+            }
+            item.body = messagePos == std::string::npos ? "" : plain.substr(messagePos + 10);
+            // drop the "." that terminated the message on the wire
+            if (item.body == ".\n" || item.body == ".")
+                item.body.clear();
+            else if (item.body.size() >= 3 && item.body.compare(item.body.size() - 3, 3, "\n.\n") == 0)
+                item.body.resize(item.body.size() - 2);
+            item.body = unstuffDots(item.body);
+            parseStats.items++;
+            addBusy(parseStats, start);
+            parsed.push(std::move(item));
+        }
+        parsed.producerDone(); });
+
+    // transform: render the RFC 822 (and for mbox the From_ line with mboxrd quoting)
+    runStage(threads, transformStats, jobs, [&]()
+             {
+        MailItem item;
+        while (parsed.pop(item))
+        {
+            auto start = Clock::now();
+            std::string message = "From: " + item.sender + "\nSubject: " + item.subject +
+                                  "\nX-Twmailer-Id: " + std::to_string(item.id) + "\n\n";
+            if (toMbox)
+            {
+                // gmtime_r: the transform threads run concurrently, gmtime's static buffer is shared
+                struct tm utc;
+                char date[32];
+                strftime(date, sizeof(date), "%a %b %e %H:%M:%S %Y", gmtime_r(&item.date, &utc));
+                std::istringstream bodyStream(item.body);
+                std::string line, body;
+                while (std::getline(bodyStream, line))
+                {
+                    size_t quotes = line.find_first_not_of('>');
+                    if (quotes != std::string::npos && line.compare(quotes, 5, "From ") == 0)
+                        line = ">" + line;
+                    body += line + "\n";
+                }
+                item.content = "From " + item.sender + " " + date + "\n" + message + body + "\n";
+            }
+            else
+            {
+                item.content = message + item.body;
+            }
+            transformStats.items++;
+            transformStats.bytes += item.content.size();
+            addBusy(transformStats, start);
+            transformed.push(std::move(item));
+        }
+        transformed.producerDone(); });
+
+    // write: append to <user>.mbox or create <user>/cur/<file>, directories once per user
+    runStage(threads, writeStats, jobs, [&]()
+             {
+        std::vector<MailItem> batch;
+        while (transformed.popBatch(batch, WRITE_BATCH))
+        {
+            auto start = Clock::now();
+            std::map<std::string, std::vector<MailItem *>> byUser;
+            for (auto &item : batch)
+                byUser[item.user].push_back(&item);
+            for (auto &group : byUser)
+            {
+                if (toMbox)
+                {
+                    outputsMutex.lock();
+                    auto &slot = mboxFiles[group.first];
+                    if (!slot)
+                    {
+                        slot.reset(new MboxFile());
+                        slot->stream.open(targetDir / (group.first + ".mbox"), std::ios::binary | std::ios::trunc);
+                    }
+                    MboxFile &mbox = *slot;
+                    outputsMutex.unlock();
+
+                    std::lock_guard<std::mutex> lock(mbox.mutex);
+                    for (MailItem *item : group.second)
+                    {
+                        writeStats.bytes += item->content.size();
+                        mbox.pending[item->seq] = std::move(item->content);
+                    }
+                    if (!flushMbox(mbox))
+                        failures++;
+                    continue;
+                }
+
+                fs::path maildir = targetDir / group.first;
+                outputsMutex.lock();
+                if (!maildirsCreated[group.first])
+                {
+                    for (const char *sub : {"cur", "new", "tmp"})
+                        fs::create_directories(maildir / sub);
+                    maildirsCreated[group.first] = true;
+                }
+                outputsMutex.unlock();
+                for (MailItem *item : group.second)
+                {
+                    std::ofstream outFile(maildir / "cur" / item->name, std::ios::binary);
+                    if (!(outFile << item->content))
+                        failures++;
+                    writeStats.bytes += item->content.size();
+                }
+            }
+            writeStats.items += batch.size();
+            addBusy(writeStats, start);
+            batch.clear();
+        } });
+
+    for (auto &thread : threads)
+        thread.join();
+    // a message that failed to parse leaves a gap, the ones behind it are still appended in order
+    for (auto &mbox : mboxFiles)
+    {
+        while (!mbox.second->pending.empty())
+        {
+            mbox.second->nextSeq = mbox.second->pending.begin()->first;
+            if (!flushMbox(*mbox.second))
+                failures++;
+        }
+    }
+    printStats({&scanStats, &parseStats, &transformStats, &writeStats});
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// ---------------------------------------------------------------------------------------------
+// rebalance: move every mailbox into the spool of the backend that owns it on the hash ring
+// ---------------------------------------------------------------------------------------------
+
+// Function to move a file, copying it if source and target are on different file systems
+static bool moveFile(const fs::path &from, const fs::path &to)
+{
+    std::error_code ec;
+    fs::rename(from, to, ec);
+    if (!ec)
+        return true;
+    return fs::copy_file(from, to, ec) && fs::remove(from, ec);
+}
+
+// Function to move a mailbox into another spool. A mailbox the target does not have yet keeps its ids,
+// otherwise the messages are appended in their order after the target's highest id.
+static bool moveMailbox(const fs::path &from, const fs::path &to, int &messages)
+{
+    std::error_code ec;
+    bool fresh = !fs::exists(to);
+    if (fresh)
+    {
+        fs::create_directories(to.parent_path());
+        fs::rename(from, to, ec);
+        if (!ec)
+        {
+            messages += getMessageIds(to).size();
+            return true;
+        }
+    }
+
+    fs::create_directories(to);
+    for (int id : getMessageIds(from))
+    {
+        int newId = fresh ? id : allocateMessageIds(to);
+        std::string name = std::to_string(id) + ".msg";
+        if (newId == 0 || !moveFile(from / name, to / (std::to_string(newId) + ".msg")))
+            return false;
+        messages++;
+    }
+    if (fresh && fs::exists(from / ".next") && !moveFile(from / ".next", to / ".next"))
+        return false;
+    fs::remove_all(from, ec);
+    return !ec;
+}
+
+static int runRebalance(const std::string &backendFile, const std::vector<std::string> &retiredSpools)
+{
+    std::map<std::string, std::string> backends;
+    if (!readBackendFile(backendFile, backends))
+    {
+        std::cerr << "Cannot read backends from " << backendFile << "\n";
+        return EXIT_FAILURE;
+    }
+    for (const auto &backend : backends)
+    {
+        if (backend.second.empty() || !fs::is_directory(backend.second))
+        {
+            std::cerr << "No spool directory for backend " << backend.first << " in " << backendFile << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+    std::map<uint64_t, std::string> ring = buildRing(backends);
+
+    // collect first, the moves change the directories being listed
+    std::vector<std::pair<std::string, fs::path>> mailboxes; // current backend ("" = retired), user dir
+    for (const auto &backend : backends)
+    {
+        for (const auto &entry : fs::directory_iterator(backend.second))
+        {
+            if (entry.is_directory())
+                mailboxes.emplace_back(backend.first, entry.path());
+        }
+    }
+    for (const auto &spool : retiredSpools)
+    {
+        for (const auto &entry : fs::directory_iterator(spool))
+        {
+            if (entry.is_directory())
+                mailboxes.emplace_back("", entry.path());
+        }
+    }
+
+    int moved = 0, messages = 0, failures = 0;
+    for (const auto &mailbox : mailboxes)
+    {
+        std::string user = mailbox.second.filename().string();
+        std::string owner = findOwner(ring, user);
+        if (owner == mailbox.first)
+            continue;
+        if (!moveMailbox(mailbox.second, fs::path(backends[owner]) / user, messages))
+        {
+            std::cerr << "Moving " << mailbox.second << " to " << owner << " failed\n";
+            failures++;
+            continue;
+        }
+        std::cout << user << ": " << (mailbox.first.empty() ? mailbox.second.parent_path().string() : mailbox.first)
+                  << " -> " << owner << "\n";
+        moved++;
+    }
+    std::cout << "Moved " << moved << " mailbox(es) with " << messages << " message(s)\n";
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Function to show the usage of the program
+void showUsage(const char *programName)
+{
+    std::cout << "Usage: " << programName << " import <source-dir> <spool-dir> [-j jobs] [-z compression-threshold]\n"
+              << "       " << programName << " export <spool-dir> <target-dir> <mbox|maildir> [-j jobs]\n"
+              << "       " << programName << " rebalance <backend-file> [retired-spool-dir ...]\n"
+              << "On import every file in source-dir is read as the mbox of the user it is named after,\n"
+              << "every directory as the user's Maildir. The server must not run on the spool during an import.\n"
+              << "Rebalance moves every mailbox to the spool of the backend that owns it, the backend file lists\n"
+              << "\"<ip>:<port> <spool-dir>\" per line. The backends must be stopped meanwhile.\n";
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        showUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::string mode = argv[1];
+    std::vector<std::string> positional;
+    int jobs = std::max(1u, std::thread::hardware_concurrency());
+    size_t compressionThreshold = 0;
+    for (int i = 2; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if ((arg == "-j" || arg == "-z") && i + 1 < argc)
+        {
+            if (arg == "-j")
+                jobs = std::max(1, std::atoi(argv[++i]));
+            else
+                compressionThreshold = std::strtoul(argv[++i], NULL, 10);
+        }
+        else
+        {
+            positional.push_back(arg);
+        }
+    }
+
+    if (mode == "import" && positional.size() == 2 && fs::is_directory(positional[0]))
+    {
+        return runImport(positional[0], positional[1], jobs, compressionThreshold);
+    }
+    if (mode == "export" && positional.size() == 3 && fs::is_directory(positional[0]) &&
+        (positional[2] == "mbox" || positional[2] == "maildir"))
+    {
+        return runExport(positional[0], positional[1], positional[2] == "mbox", jobs);
+    }
+    if (mode == "rebalance" && !positional.empty())
+    {
+        return runRebalance(positional[0], std::vector<std::string>(positional.begin() + 1, positional.end()));
+    }
+    showUsage(argv[0]);
+    return EXIT_FAILURE;
+}